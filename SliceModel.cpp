@@ -1,5 +1,6 @@
 // ---------------------------------------------------------------------------
 #include <string>
+#include <cstring>
 #include <filesystem>
 #include <QFileInfo>
 #include <QImage>
@@ -24,36 +25,52 @@ SliceModel::SliceModel(fib_data* handle_,uint32_t view_id_):handle(handle_),view
     slice_pos[2] = dim.depth() >> 1;
 }
 // ---------------------------------------------------------------------------
-void SliceModel::apply_overlay(tipl::color_image& show_image,
-                    unsigned char cur_dim,
-                    std::shared_ptr<SliceModel> other_slice,
-                               float zoom) const
+void apply_overlay(tipl::color_image& show_image,unsigned char cur_dim,int pos,float zoom,
+                   const tipl::matrix<4,4>* to_dif,const tipl::matrix<4,4>* to_other,
+                   tipl::const_pointer_image<3> other_image,
+                   const tipl::value_to_color<float>& v2c,std::pair<float,float> range)
 {
-    if(show_image.empty())
+    if(show_image.empty() || !other_image.size())
         return;
-    bool op = show_image[0][0] < 128;
-    const auto& v2c = other_slice->handle->view_item[other_slice->view_id].v2c;
-    std::pair<float,float> range = other_slice->get_contrast_range();
-    for(int y = 0,pos = 0;y < show_image.height();++y)
-        for(int x = 0;x < show_image.width();++x,++pos)
+    int w = show_image.width();
+    tipl::par_for(show_image.height(),[&](int y)
+    {
+        int sy = zoom != 1.0f ? int(float(y)*zoom) : y;
+        auto out = show_image.begin() + int64_t(y)*w;
+        for(int x = 0;x < w;++x)
         {
+            auto v = tipl::slice2space<tipl::vector<3> >(cur_dim,zoom != 1.0f ? int(float(x)*zoom) : x,sy,pos);
+            if(to_dif)
+                v.to(*to_dif);
+            if(to_other)
+                v.to(*to_other);
             float value = 0;
-            if(!tipl::estimate(other_slice->get_source(),toOtherSlice(other_slice,cur_dim,
-                                                                      zoom != 1.0f ? float(x)*zoom : float(x),
-                                                                      zoom != 1.0f ? float(y)*zoom : float(y)),value))
+            if(!tipl::estimate(other_image,v,value))
                 continue;
             if((value > 0.0f && value > range.first) ||
                (value < 0.0f && value < range.second))
             {
-                show_image[pos][0] >>= 1;
-                show_image[pos][1] >>= 1;
-                show_image[pos][2] >>= 1;
-                show_image[pos][0] += v2c[value][0] >> 1;
-                show_image[pos][1] += v2c[value][1] >> 1;
-                show_image[pos][2] += v2c[value][2] >> 1;
+                auto& p = out[x];
+                auto c = v2c[value];
+                p[0] = (p[0] >> 1) + (c[0] >> 1);
+                p[1] = (p[1] >> 1) + (c[1] >> 1);
+                p[2] = (p[2] >> 1) + (c[2] >> 1);
             }
-
         }
+    });
+}
+// ---------------------------------------------------------------------------
+void SliceModel::apply_overlay(tipl::color_image& show_image,
+                    unsigned char cur_dim,int pos,
+                    std::shared_ptr<SliceModel> other_slice,
+                               float zoom) const
+{
+    ::apply_overlay(show_image,cur_dim,pos,zoom,
+                    is_diffusion_space ? nullptr : &to_dif,
+                    other_slice->is_diffusion_space ? nullptr : &other_slice->to_slice,
+                    other_slice->get_source(),
+                    other_slice->handle->view_item[other_slice->view_id].v2c,
+                    other_slice->get_contrast_range());
 }
 
 
@@ -95,7 +112,7 @@ void SliceModel::get_slice(tipl::color_image& show_image,unsigned char cur_dim,i
     handle->get_slice(view_id,cur_dim, pos,show_image);
     for(auto overlay_slice : overlay_slices)
         if(this != overlay_slice.get())
-            apply_overlay(show_image,cur_dim,overlay_slice);
+            apply_overlay(show_image,cur_dim,pos,overlay_slice);
 }
 // ---------------------------------------------------------------------------
 void SliceModel::get_high_reso_slice(tipl::color_image& show_image,unsigned char cur_dim,int pos,
@@ -120,6 +137,33 @@ std::string SliceModel::get_name(void) const
     return handle->view_item[view_id].name;
 }
 // ---------------------------------------------------------------------------
+slice_state SliceModel::get_state(void) const
+{
+    slice_state state;
+    auto& item = handle->view_item[view_id];
+    state.handle = handle;
+    state.fiber_color = (item.name == "color");
+    state.image = state.fiber_color ? handle->view_item[0].get_image() : item.get_image();
+    state.source = get_source();
+    state.v2c = item.v2c;
+    state.contrast_range = get_contrast_range();
+    state.is_diffusion_space = is_diffusion_space;
+    state.to_dif = to_dif;
+    state.to_slice = to_slice;
+    return state;
+}
+// ---------------------------------------------------------------------------
+void draw_slice(const slice_state& slice,const std::vector<slice_state>& overlays,
+                unsigned char cur_dim,int pos,tipl::color_image& image)
+{
+    slice.handle->get_slice(slice.image,slice.fiber_color,slice.v2c,cur_dim,uint32_t(pos),image);
+    for(const auto& overlay : overlays)
+        apply_overlay(image,cur_dim,pos,1.0f,
+                      slice.is_diffusion_space ? nullptr : &slice.to_dif,
+                      overlay.is_diffusion_space ? nullptr : &overlay.to_slice,
+                      overlay.source,overlay.v2c,overlay.contrast_range);
+}
+// ---------------------------------------------------------------------------
 CustomSliceModel::CustomSliceModel(fib_data* new_handle):
     SliceModel(new_handle,0)
 {
@@ -138,7 +182,7 @@ void CustomSliceModel::get_slice(tipl::color_image& image,
             image = picture_warped;
         for(auto overlay_slice : overlay_slices)
             if(this != overlay_slice.get())
-                apply_overlay(image,cur_dim,overlay_slice);
+                apply_overlay(image,cur_dim,pos,overlay_slice);
     }
     else
         SliceModel::get_slice(image,cur_dim,pos,overlay_slices);
@@ -155,7 +199,7 @@ void CustomSliceModel::get_high_reso_slice(tipl::color_image& image,unsigned cha
             image = high_reso_picture_warped;
         for(auto overlay_slice : overlay_slices)
             if(this != overlay_slice.get())
-                apply_overlay(image,cur_dim,overlay_slice,float(picture.width())/float(high_reso_picture.width()));
+                apply_overlay(image,cur_dim,pos,overlay_slice,float(picture.width())/float(high_reso_picture.width()));
     }
     else
         get_slice(image,cur_dim,pos,overlay_slices);
@@ -441,6 +485,7 @@ bool CustomSliceModel::load_slices(const std::vector<std::string>& files,bool is
         tipl::out() << "dimension: " << source_images.shape() << std::endl;
         if(source_images.shape() == handle->dim)
             tipl::out() << "The slices have the same dimension as DWI." << std::endl;
+        handle->wait_prefetch();
         handle->view_item.push_back(item(name,&*source_images.begin(),source_images.shape()));
         handle->view_item.back().T = to_dif;
         handle->view_item.back().iT = to_slice;
@@ -603,3 +648,176 @@ void CustomSliceModel::terminate(void)
     wait();
 }
 // ---------------------------------------------------------------------------
+inline uint64_t slice_hash(uint64_t h,uint64_t value){return (h ^ value)*1099511628211ULL;}
+inline uint64_t slice_hash(uint64_t h,float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits,&value,sizeof(bits));
+    return slice_hash(h,uint64_t(bits));
+}
+inline uint64_t slice_hash(uint64_t h,const SliceModel& slice)
+{
+    const auto& item = slice.handle->view_item[slice.view_id];
+    h = slice_hash(h,uint64_t(reinterpret_cast<uintptr_t>(&slice)));
+    h = slice_hash(h,uint64_t(reinterpret_cast<uintptr_t>(slice.handle)));
+    h = slice_hash(h,uint64_t(slice.view_id) << 1 | uint64_t(slice.is_diffusion_space));
+    for(size_t i = 0;i < 16;++i)
+    {
+        h = slice_hash(h,slice.to_dif[i]);
+        h = slice_hash(h,slice.to_slice[i]);
+    }
+    // contrast and color map, sampled through the lookup itself
+    h = slice_hash(h,item.contrast_min);
+    h = slice_hash(h,item.contrast_max);
+    for(unsigned int i = 0;i <= 16;++i)
+    {
+        auto c = item.v2c[item.contrast_min+(item.contrast_max-item.contrast_min)*float(i)/16.0f];
+        h = slice_hash(h,uint64_t(c[0]) << 16 | uint64_t(c[1]) << 8 | uint64_t(c[2]));
+    }
+    // image buffer, shape, and a sparse sample of the values to catch in-place edits
+    auto I = slice.get_source();
+    h = slice_hash(h,uint64_t(reinterpret_cast<uintptr_t>(I.begin())));
+    for(unsigned int d = 0;d < 3;++d)
+        h = slice_hash(h,uint64_t(I.shape()[d]));
+    if(I.size())
+        for(size_t i = 0,step = I.size()/1024+1;i < I.size();i += step)
+            h = slice_hash(h,I[i]);
+    return h;
+}
+uint64_t slice_image_cache::get_key(const SliceModel& slice,unsigned char cur_dim,int pos,const slices_type& overlay_slices)
+{
+    auto custom_slice = dynamic_cast<const CustomSliceModel*>(&slice);
+    if(custom_slice && !custom_slice->picture.empty())
+        return 0;
+    uint64_t h = slice_hash(14695981039346656037ULL,uint64_t(cur_dim) << 32 | uint64_t(uint32_t(pos)));
+    h = slice_hash(h,slice);
+    for(const auto& overlay_slice : overlay_slices)
+        if(overlay_slice.get() != &slice)
+            h = slice_hash(h,*overlay_slice);
+    return h ? h : 1;
+}
+// ---------------------------------------------------------------------------
+slice_image_cache::~slice_image_cache(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        terminated = true;
+        jobs.clear();
+    }
+    cv.notify_all();
+    if(worker.joinable())
+        worker.join();
+}
+// ---------------------------------------------------------------------------
+slice_image_cache::image_type slice_image_cache::find(uint64_t key)
+{
+    for(auto iter = images.begin();iter != images.end();++iter)
+        if(iter->first == key)
+        {
+            images.splice(images.begin(),images,iter);
+            return images.front().second;
+        }
+    return image_type();
+}
+// ---------------------------------------------------------------------------
+void slice_image_cache::insert(uint64_t key,image_type image)
+{
+    if(find(key))
+        return;
+    images.emplace_front(key,image);
+    while(images.size() > max_size)
+        images.pop_back();
+}
+// ---------------------------------------------------------------------------
+void slice_image_cache::run(void)
+{
+    while(true)
+    {
+        job_type job;
+        slices_type overlay_slices;
+        std::vector<slice_state> overlay_states;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock,[&](void){return terminated || !jobs.empty();});
+            if(terminated)
+                return;
+            job = jobs.front();
+            jobs.pop_front();
+            overlay_slices = job_overlay_slices;
+            overlay_states = job_overlay_states;
+            if(find(job.key))
+                continue;
+            running_key = job.key;
+        }
+        // drawn from the states the key was computed from, so the image matches the key
+        // even if the view has changed since
+        auto I = std::make_shared<tipl::color_image>();
+        draw_slice(job.state,overlay_states,job.cur_dim,job.pos,*I);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running_key = 0;
+            insert(job.key,I);
+        }
+        cv.notify_all();
+    }
+}
+// ---------------------------------------------------------------------------
+void slice_image_cache::get_slice(std::shared_ptr<SliceModel> slice,unsigned char cur_dim,int pos,
+                                  const slices_type& overlay_slices,tipl::color_image& image)
+{
+    auto key = get_key(*slice,cur_dim,pos,overlay_slices);
+    if(!key)
+    {
+        slice->get_slice(image,cur_dim,pos,overlay_slices);
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        // the worker is already computing this slice
+        cv.wait(lock,[&](void){return running_key != key;});
+        if(auto I = find(key))
+        {
+            image = *I;
+            return;
+        }
+    }
+    auto I = std::make_shared<tipl::color_image>();
+    slice->get_slice(*I,cur_dim,pos,overlay_slices);
+    image = *I;
+    std::lock_guard<std::mutex> lock(mutex);
+    insert(key,I);
+}
+// ---------------------------------------------------------------------------
+void slice_image_cache::prefetch(std::shared_ptr<SliceModel> slice,const std::vector<std::pair<unsigned char,int> >& dim_pos,
+                                 const slices_type& overlay_slices)
+{
+    std::list<job_type> new_jobs;
+    auto state = slice->get_state();
+    for(const auto& each : dim_pos)
+        if(each.second >= 0 && each.second < int(slice->dim[each.first]))
+        {
+            auto key = get_key(*slice,each.first,each.second,overlay_slices);
+            if(key)
+                new_jobs.push_back(job_type{slice,state,each.first,each.second,key});
+        }
+    std::vector<slice_state> overlay_states;
+    for(const auto& overlay_slice : overlay_slices)
+        if(overlay_slice != slice)
+            overlay_states.push_back(overlay_slice->get_state());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.swap(new_jobs);
+        job_overlay_slices = overlay_slices;
+        job_overlay_states.swap(overlay_states);
+    }
+    cv.notify_all();
+}
+// ---------------------------------------------------------------------------
+void slice_image_cache::clear(void)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    jobs.clear();
+    images.clear();
+    cv.wait(lock,[&](void){return running_key == 0;});
+}
+// ---------------------------------------------------------------------------
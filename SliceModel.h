@@ -1,11 +1,25 @@
 #ifndef SliceModelH
 #define SliceModelH
 #include <future>
+#include <list>
+#include <mutex>
+#include <condition_variable>
 #include "zlib.h"
 #include "TIPL/tipl.hpp"
 
 // ---------------------------------------------------------------------------
 class fib_data;
+// what drawing a slice reads from the slice and its view item, copied on the UI thread
+// so that another thread can draw the slice while the view changes
+struct slice_state{
+    fib_data* handle = nullptr;
+    tipl::const_pointer_image<3> image,source; // image: drawn by fib_data::get_slice, source: blended as an overlay
+    bool fiber_color = false;
+    tipl::value_to_color<float> v2c;
+    std::pair<float,float> contrast_range;
+    bool is_diffusion_space = true;
+    tipl::matrix<4,4> to_dif,to_slice;
+};
 class SliceModel {
 public:
     fib_data* handle = nullptr;
@@ -38,6 +52,7 @@ public:
                            const std::vector<std::shared_ptr<SliceModel> >& overlay_slices) const;
     virtual tipl::const_pointer_image<3> get_source(void) const;
     std::string get_name(void) const;
+    slice_state get_state(void) const;
 public:
     auto toDiffusionSpace(unsigned char cur_dim,int x,int y) const
     {
@@ -103,11 +118,64 @@ public:
                 p.to(to_dif);
     }
     void apply_overlay(tipl::color_image& show_image,
-                       unsigned char dim,
+                       unsigned char dim,int pos,
                        std::shared_ptr<SliceModel> other_slice,
                        float zoom = 1.0f) const;
 };
 
+// blend a color-mapped volume into a slice image. pixel (x,y) of the slice at pos is
+// mapped by slice2space, then to_dif and to_other (if not null). no Qt dependency.
+void apply_overlay(tipl::color_image& show_image,unsigned char cur_dim,int pos,float zoom,
+                   const tipl::matrix<4,4>* to_dif,const tipl::matrix<4,4>* to_other,
+                   tipl::const_pointer_image<3> other_image,
+                   const tipl::value_to_color<float>& v2c,std::pair<float,float> range);
+
+// same as SliceModel::get_slice, from copied states. overlays should not include the slice itself.
+void draw_slice(const slice_state& slice,const std::vector<slice_state>& overlays,
+                unsigned char cur_dim,int pos,tipl::color_image& image);
+
+// recently viewed slices (with overlays) keyed by view, position, contrast, transforms,
+// and a sampled image signature. neighboring slices are prefetched by a worker thread
+// that draws from slice states copied at the request, never from the live slices;
+// a new prefetch request drops the pending ones so the worker never lags behind scrolling.
+class slice_image_cache{
+public:
+    using image_type = std::shared_ptr<const tipl::color_image>;
+    using slices_type = std::vector<std::shared_ptr<SliceModel> >;
+    size_t max_size = 64;
+private:
+    struct job_type{
+        std::shared_ptr<SliceModel> slice; // keeps the images referenced by state alive
+        slice_state state;
+        unsigned char cur_dim;
+        int pos;
+        uint64_t key;
+    };
+    std::list<std::pair<uint64_t,image_type> > images; // most recently used first
+    std::list<job_type> jobs;
+    slices_type job_overlay_slices;
+    std::vector<slice_state> job_overlay_states;
+    uint64_t running_key = 0;
+    bool terminated = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread worker;
+    image_type find(uint64_t key);
+    void insert(uint64_t key,image_type image);
+    void run(void);
+public:
+    slice_image_cache(void):worker([this](void){run();}){}
+    ~slice_image_cache(void);
+    // 0: the slice cannot be cached (e.g. a 2D picture)
+    static uint64_t get_key(const SliceModel& slice,unsigned char cur_dim,int pos,const slices_type& overlay_slices);
+    void get_slice(std::shared_ptr<SliceModel> slice,unsigned char cur_dim,int pos,
+                   const slices_type& overlay_slices,tipl::color_image& image);
+    void prefetch(std::shared_ptr<SliceModel> slice,const std::vector<std::pair<unsigned char,int> >& dim_pos,
+                  const slices_type& overlay_slices);
+    // drop all cached images and pending requests, and wait for the running one
+    void clear(void);
+};
+
 class CustomSliceModel : public SliceModel {
 public:
     std::vector<std::string> dicom_source;
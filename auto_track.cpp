@@ -113,7 +113,6 @@ struct file_holder{
     }
 };
 
-void set_template(std::shared_ptr<fib_data> handle,tipl::program_option<tipl::out>& po);
 std::string run_auto_track(tipl::program_option<tipl::out>& po,const std::vector<std::string>& file_list,int& prog)
 {
     std::string tolerance_string = po.get("tolerance","22,26,30");
@@ -124,6 +123,8 @@ std::string run_auto_track(tipl::program_option<tipl::out>& po,const std::vector
     bool export_trk = po.get("export_trk",1);
     bool overwrite = po.get("overwrite",0);
     bool export_template_trk = po.get("export_template_trk",0);
+    // 0: uniform seeding that gives reproducible results
+    bool adaptive_seeding = po.get("adaptive_seeding",0);
     uint32_t thread_count = tipl::max_thread_count = po.get("thread_count",tipl::max_thread_count);
     std::string trk_format = po.get("trk_format","tt.gz");
     std::string stat_format = po.get("stat_format","stat.txt");
@@ -196,6 +197,72 @@ std::string run_auto_track(tipl::program_option<tipl::out>& po,const std::vector
     std::vector<std::vector<std::string> > stat_files(tract_name_list.size());
     std::string dir = po.get("output",QFileInfo(file_list.front().c_str()).absolutePath().toStdString());
 
+    // the next subject is loaded and registered in the background while the current one is being tracked
+    bool pipeline = po.get("pipeline",1) && file_list.size() > 1;
+    bool has_template = po.has("template");
+    size_t template_id = po.get("template",size_t(0));
+    auto need_tracking = [&](const std::string& fib_file_name)
+    {
+        std::string fib_base = QFileInfo(fib_file_name.c_str()).baseName().toStdString();
+        for(const auto& tract_name : tract_name_list)
+        {
+            std::string output_path = dir + "/" + tract_name + "/";
+            std::string trk_file_name = output_path + fib_base+"."+tract_name+ "." + trk_format;
+            if(std::filesystem::exists(output_path + fib_base+"."+tract_name+".no_result.txt") && !overwrite)
+                continue;
+            bool has_stat_file = std::filesystem::exists(output_path + fib_base+"."+tract_name+"." + stat_format);
+            bool has_trk_file = std::filesystem::exists(trk_file_name) &&
+                    (!export_template_trk || std::filesystem::exists(output_path + "T_" + fib_base+"."+tract_name + "." + trk_format));
+            if(overwrite || (export_stat && !has_stat_file) || (export_trk && !has_trk_file))
+                return true;
+        }
+        return false;
+    };
+    auto load_subject = [=](std::shared_ptr<fib_data> handle,const std::string& fib_file_name)
+    {
+        if(!handle->load_from_file(fib_file_name.c_str()))
+            return false;
+        if(has_template)
+            handle->set_template_id(template_id);
+        // tract statistics need all metrics, load them while tracking
+        if(export_stat)
+        {
+            std::vector<std::string> names;
+            for(const auto& each : handle->view_item)
+                names.push_back(each.name);
+            handle->prefetch_items(names);
+        }
+        return true;
+    };
+    std::shared_ptr<fib_data> next_handle;
+    bool stop_loading = false;
+    std::future<bool> next_loading;
+    // stops the background registration when the batch ends early (destroyed before next_loading)
+    struct stop_on_exit{
+        bool& flag;
+        ~stop_on_exit(void){flag = true;}
+    } stop_loading_on_exit{stop_loading};
+    size_t next_index = 0;
+    auto load_next_subject = [&](size_t from)
+    {
+        if(!pipeline || next_loading.valid())
+            return;
+        for(next_index = from;next_index < file_list.size();++next_index)
+            if(need_tracking(file_list[next_index]))
+            {
+                auto handle = next_handle = std::make_shared<fib_data>();
+                auto file_name = file_list[next_index];
+                tipl::out() << "loading " << std::filesystem::path(file_name).filename().string() << " in the background" << std::endl;
+                // the registration runs with no_progress and leaves the global abort flag alone,
+                // a failure is reported when the subject becomes current
+                next_loading = std::async(std::launch::async,[load_subject,handle,file_name,&stop_loading](void)
+                {
+                    return load_subject(handle,file_name) && handle->map_to_mni_in_worker(stop_loading);
+                });
+                return;
+            }
+    };
+
     std::vector<std::string> scan_names;
     tipl::progress prog0("automatic fiber tracking");
     for(size_t i = 0;prog0(i,file_list.size());++i)
@@ -206,6 +273,12 @@ std::string run_auto_track(tipl::program_option<tipl::out>& po,const std::vector
         scan_names.push_back(cur_file_base_name);
         tipl::out() << "processing " << cur_file_base_name << std::endl;
         std::shared_ptr<fib_data> handle;
+        // a subject loaded ahead but then skipped
+        if(next_loading.valid() && next_index < i)
+        {
+            next_loading.get();
+            next_handle.reset();
+        }
 
         tipl::progress prog1("tracking pathways");
         for(size_t j = 0;prog1(j,tract_name_list.size());++j)
@@ -256,10 +329,20 @@ std::string run_auto_track(tipl::program_option<tipl::out>& po,const std::vector
 
                 if (!handle.get())
                 {
-                    handle = std::make_shared<fib_data>();
-                    if(!handle->load_from_file(fib_file_name.c_str()))
-                       return handle->error_msg;
-                    set_template(handle,po);
+                    if(next_loading.valid() && next_index == i)
+                    {
+                        handle = next_handle;
+                        next_handle.reset();
+                        if(!next_loading.get())
+                            return handle->error_msg + " at " + fib_file_name;
+                    }
+                    else
+                    {
+                        handle = std::make_shared<fib_data>();
+                        if(!load_subject(handle,fib_file_name))
+                           return handle->error_msg;
+                    }
+                    load_next_subject(i+1);
                 }
                 TractModel tract_model(handle);
                 if(!overwrite && has_trk_file)
@@ -296,6 +379,7 @@ std::string run_auto_track(tipl::program_option<tipl::out>& po,const std::vector
                         thread.roi_mgr->track_voxel_ratio = track_voxel_ratio;
                         thread.roi_mgr->tract_name = tract_name;
                         thread.roi_mgr->tolerance_dis_in_icbm152_mm = tolerance[tracking_iteration];
+                        thread.adaptive_seeding = adaptive_seeding;
                     }
                     tipl::progress prog2("tracking ",tract_name.c_str(),true);
                     thread.run(thread_count,false);
@@ -335,6 +419,8 @@ std::string run_auto_track(tipl::program_option<tipl::out>& po,const std::vector
                                                        float(thread.get_total_tract_count())/sec << std::endl;
                             tipl::out() << "seed yield rate (seeds per second): " <<
                                                        float(thread.get_total_seed_count())/sec << std::endl;
+                            if(adaptive_seeding)
+                                tipl::out() << thread.get_seed_yield_report() << std::endl;
                         }
 
                     }
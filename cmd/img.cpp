@@ -26,6 +26,64 @@ bool variant_image::command(std::string cmd,std::string param1)
     return result;
 }
 
+bool is_point_wise_command(const std::string& cmd,const std::string& param,float& value)
+{
+    if(cmd != "add_value" && cmd != "multiply_value" && cmd != "lower_threshold" && cmd != "upper_threshold")
+        return false;
+    std::istringstream in(param);
+    return (in >> value) && (in >> std::ws).eof();
+}
+
+bool variant_image::fused_command(const std::vector<std::pair<std::string,std::string> >& cmds)
+{
+    std::vector<std::pair<char,float> > ops;
+    for(const auto& each : cmds)
+    {
+        float value = 0.0f;
+        if(pixel_type != float32 || !is_point_wise_command(each.first,each.second,value))
+        {
+            ops.clear();
+            break;
+        }
+        char op = '*';
+        if(each.first == "add_value")
+            op = '+';
+        if(each.first == "lower_threshold")
+            op = 'l';
+        if(each.first == "upper_threshold")
+            op = 'u';
+        ops.push_back(std::make_pair(op,value));
+    }
+    if(ops.empty())
+    {
+        for(const auto& each : cmds)
+            if(!command(each.first,each.second))
+                return false;
+        return true;
+    }
+    // each voxel goes through the whole chain while it is in cache
+    error_msg.clear();
+    size_t block_size = std::max<size_t>(1,I_float32.size()/tipl::max_thread_count/4);
+    tipl::par_for((I_float32.size()+block_size-1)/block_size,[&](size_t block)
+    {
+        auto from = I_float32.begin()+block*block_size;
+        auto to = I_float32.begin()+std::min<size_t>(I_float32.size(),(block+1)*block_size);
+        for(;from != to;++from)
+        {
+            float v = *from;
+            for(const auto& op : ops)
+                switch(op.first)
+                {
+                    case '+':v += op.second;break;
+                    case '*':v *= op.second;break;
+                    case 'l':if(v < op.second) v = op.second;break;
+                    case 'u':if(v > op.second) v = op.second;break;
+                }
+            *from = v;
+        }
+    });
+    return true;
+}
 
 bool variant_image::read_mat_image(const std::string& metric_name,tipl::io::gz_mat_read& mat)
 {
@@ -65,23 +123,31 @@ void variant_image::change_type(decltype(pixel_type) new_type)
         return;
     apply([&](auto& I)
     {
+        auto convert = [&](auto& new_I)
+        {
+            new_I.resize(shape);
+            // a type change is a full memory pass, split it across threads
+            size_t block_size = std::max<size_t>(1,I.size()/tipl::max_thread_count/4);
+            tipl::par_for((I.size()+block_size-1)/block_size,[&](size_t block)
+            {
+                size_t from = block*block_size;
+                size_t to = std::min<size_t>(I.size(),from+block_size);
+                std::copy(I.begin()+from,I.begin()+to,new_I.begin()+from);
+            });
+        };
         switch(new_type)
         {
             case int8:
-                I_int8.resize(shape);
-                std::copy(I.begin(),I.end(),&I_int8[0]);
+                convert(I_int8);
                 break;
             case int16:
-                I_int16.resize(shape);
-                std::copy(I.begin(),I.end(),&I_int16[0]);
+                convert(I_int16);
                 break;
             case int32:
-                I_int32.resize(shape);
-                std::copy(I.begin(),I.end(),&I_int32[0]);
+                convert(I_int32);
                 break;
             case float32:
-                I_float32.resize(shape);
-                std::copy(I.begin(),I.end(),&I_float32[0]);
+                convert(I_float32);
         }
         I.clear();
     });
@@ -317,6 +383,34 @@ bool variant_image::load_from_file(const char* file_name,std::string& info)
             }
     return true;
 }
+bool is_lossless_type_change(size_t from,size_t to)
+{
+    if(from == to || (from <= variant_image::int16 && to == variant_image::float32))
+        return true;
+    return from < to && to <= variant_image::int32;
+}
+// each skipped type change would otherwise be a full copy of the volume
+std::vector<std::pair<std::string,std::string> > optimize_img_commands(
+        const std::vector<std::pair<std::string,std::string> >& cmds,size_t pixel_type)
+{
+    std::vector<std::pair<std::string,std::string> > result;
+    for(size_t i = 0;i < cmds.size();++i)
+    {
+        if(cmds[i].first == "change_type")
+        {
+            size_t new_type = size_t(std::stoi(cmds[i].second));
+            // followed by another type change: skip this one if it does not truncate values
+            if(i+1 < cmds.size() && cmds[i+1].first == "change_type" &&
+               is_lossless_type_change(pixel_type,new_type))
+                continue;
+            if(new_type == pixel_type)
+                continue;
+            pixel_type = new_type;
+        }
+        result.push_back(cmds[i]);
+    }
+    return result;
+}
 int img(tipl::program_option<tipl::out>& po)
 {
     std::string source(po.get("source")),info;
@@ -326,6 +420,7 @@ int img(tipl::program_option<tipl::out>& po)
         tipl::out() << "ERROR: " << var_image.error_msg;
         return 0;
     }
+    std::vector<std::pair<std::string,std::string> > cmds;
     for(auto& cmd : tipl::split(po.get("cmd"),','))
     {
         std::string param;
@@ -335,6 +430,20 @@ int img(tipl::program_option<tipl::out>& po)
             param = cmd.substr(sep_pos+1);
             cmd = cmd.substr(0,sep_pos);
         }
+        if(cmd == "change_type" && (param.size() != 1 || param[0] < '0' || param[0] > '3'))
+        {
+            tipl::out() << "ERROR: invalid pixel type " << param;
+            return 0;
+        }
+        cmds.push_back(std::make_pair(cmd,param));
+    }
+    auto optimized_cmds = optimize_img_commands(cmds,var_image.pixel_type);
+    if(optimized_cmds.size() != cmds.size())
+        tipl::out() << "skip " << cmds.size()-optimized_cmds.size() << " redundant type change(s)";
+    for(size_t i = 0;i < optimized_cmds.size();++i)
+    {
+        const auto& cmd = optimized_cmds[i].first;
+        const auto& param = optimized_cmds[i].second;
         if(param.empty())
             tipl::out() << cmd;
         else
@@ -344,6 +453,26 @@ int img(tipl::program_option<tipl::out>& po)
             tipl::out() << info;
             continue;
         }
+        // a run of point-wise commands on a float32 image takes one pass instead of one per command
+        size_t j = i;
+        float value = 0.0f;
+        while(var_image.pixel_type == variant_image::float32 && j < optimized_cmds.size() &&
+              is_point_wise_command(optimized_cmds[j].first,optimized_cmds[j].second,value))
+            ++j;
+        if(j > i+1)
+        {
+            for(size_t k = i+1;k < j;++k)
+                tipl::out() << optimized_cmds[k].first << ":" << optimized_cmds[k].second;
+            tipl::out() << "applying " << j-i << " point-wise commands in one pass";
+            if(!var_image.fused_command(std::vector<std::pair<std::string,std::string> >(
+                                            optimized_cmds.begin()+int(i),optimized_cmds.begin()+int(j))))
+            {
+                tipl::out() << "ERROR: " << var_image.error_msg;
+                return 0;
+            }
+            i = j-1;
+            continue;
+        }
         if(!var_image.command(cmd,param))
         {
             tipl::out() << "ERROR: " << var_image.error_msg;
@@ -49,8 +49,18 @@ public:
     bool read_mat_image(const std::string& metric_name,tipl::io::gz_mat_read& mat);
     void change_type(decltype(pixel_type));
     bool command(std::string cmd,std::string param1);
+    // consecutive point-wise commands applied to a float32 image in one pass
+    bool fused_command(const std::vector<std::pair<std::string,std::string> >& cmds);
     bool load_from_file(const char* file_name,std::string& info);
     bool empty(void) const{return shape.size() == 0;}
     size_t buf_size(void) const { return shape.size()*pixelbit[pixel_type];}
 };
+
+// add_value, multiply_value, lower_threshold, and upper_threshold with a numeric value
+bool is_point_wise_command(const std::string& cmd,const std::string& param,float& value);
+// true if every value of the "from" type is kept exactly by the "to" type
+bool is_lossless_type_change(size_t from,size_t to);
+// removes type changes that do not alter the result
+std::vector<std::pair<std::string,std::string> > optimize_img_commands(
+        const std::vector<std::pair<std::string,std::string> >& cmds,size_t pixel_type);
 #endif // IMG_HPP
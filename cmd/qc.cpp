@@ -1,13 +1,270 @@
 #include <QString>
 #include <QStringList>
 #include <QFileInfo>
+#include <future>
+#include <chrono>
+#include <numeric>
 #include "libs/dsi/image_model.hpp"
 #include "fib_data.hpp"
 
 QStringList search_files(QString dir,QString filter);
-const char* src_qc_title = "FileName\tImage dimension\tResolution\tDWI count\tMax b-value\tDWI contrast\tNeighboring DWI correlation\tNeighboring DWI correlation(masked)\t# Bad Slices";
+const char* src_qc_title = "FileName\tImage dimension\tResolution\tDWI count\tMax b-value\tDWI contrast\tNeighboring DWI correlation\tNeighboring DWI correlation(masked)\t# Bad Slices\tQC time(s)";
+
+std::vector<size_t> get_bad_slices(const unsigned short* I,const tipl::shape<3>& dim);
+std::vector<std::pair<size_t,size_t> > get_neighboring_dwi_pairs(const std::vector<float>& bvalues,
+                                                                 const std::vector<tipl::vector<3,float> >& bvectors);
+void get_dwi_contrast_pairs(const std::vector<float>& bvalues,
+                            const std::vector<tipl::vector<3,float> >& bvectors,
+                            std::vector<size_t>& dwi_self,
+                            std::vector<size_t>& dwi_neighbor,
+                            std::vector<size_t>& dwi_ortho);
+float masked_correlation(const unsigned short* I1_ptr,const unsigned short* I2_ptr,tipl::image<3,unsigned char>& mask);
+
+/*
+ single-pass SRC quality control: the SRC file is read matrix by matrix and each DWI
+ is checked while the next one is being inflated. Only DWIs used by the neighboring
+ or contrast correlation pairs stay resident until the mask (stored after the DWIs)
+ is available.
+ */
+class src_qc_stream{
+private:
+    tipl::io::gz_istream in;
+    std::vector<std::vector<unsigned short> > dwi;
+    std::vector<char> dwi_needed;
+    std::vector<std::pair<size_t,size_t> > ndc_pairs;
+    std::vector<size_t> dwi_self,dwi_neighbor,dwi_ortho;
+    std::vector<float> ndc;
+    std::vector<size_t> bad_slice_count;
+    bool has_b_table = false;
+private:
+    static size_t element_size(uint32_t type)
+    {
+        if(type >= 1000) // big endian or other machine formats
+            return 0;
+        switch((type/10)%10)
+        {
+            case 0: return 8;
+            case 1: case 2: return 4;
+            case 3: case 4: return 2;
+            case 5: return 1;
+        }
+        return 0;
+    }
+    template<typename value_type>
+    static void convert(const std::vector<char>& buf,uint32_t type,std::vector<value_type>& out)
+    {
+        out.resize(buf.size()/element_size(type));
+        switch((type/10)%10)
+        {
+            case 0: std::copy_n(reinterpret_cast<const double*>(buf.data()),out.size(),out.begin());return;
+            case 1: std::copy_n(reinterpret_cast<const float*>(buf.data()),out.size(),out.begin());return;
+            case 2: std::copy_n(reinterpret_cast<const int32_t*>(buf.data()),out.size(),out.begin());return;
+            case 3: std::copy_n(reinterpret_cast<const int16_t*>(buf.data()),out.size(),out.begin());return;
+            case 4: std::copy_n(reinterpret_cast<const uint16_t*>(buf.data()),out.size(),out.begin());return;
+            case 5: std::copy_n(reinterpret_cast<const uint8_t*>(buf.data()),out.size(),out.begin());return;
+        }
+    }
+    bool read_header(std::string& name,uint32_t& type,size_t& size)
+    {
+        uint32_t header[5]; // type, rows, cols, imagf, name length
+        if(!in.read(reinterpret_cast<char*>(header),sizeof(header)) || header[3] || !header[4])
+            return false;
+        name.resize(header[4]);
+        if(!in.read(&name[0],header[4]))
+            return false;
+        name = name.c_str();
+        type = header[0];
+        size = size_t(header[1])*size_t(header[2])*element_size(type);
+        return element_size(type);
+    }
+    void set_b_table(const std::vector<float>& table)
+    {
+        for(size_t i = 0;i+3 < table.size();i += 4)
+        {
+            bvalues.push_back(table[i]);
+            bvectors.push_back(tipl::vector<3,float>(table[i+1],table[i+2],table[i+3]));
+            bvectors.back().normalize();
+        }
+        ndc_pairs = get_neighboring_dwi_pairs(bvalues,bvectors);
+        get_dwi_contrast_pairs(bvalues,bvectors,dwi_self,dwi_neighbor,dwi_ortho);
+        dwi.resize(bvalues.size());
+        dwi_needed.resize(bvalues.size());
+        bad_slice_count.resize(bvalues.size());
+        ndc.resize(ndc_pairs.size());
+        for(const auto& each : ndc_pairs)
+            dwi_needed[each.first] = dwi_needed[each.second] = 1;
+        for(size_t i = 0;i < dwi_self.size();++i)
+            dwi_needed[dwi_self[i]] = dwi_needed[dwi_neighbor[i]] = dwi_needed[dwi_ortho[i]] = 1;
+        has_b_table = true;
+    }
+    // called once DWI #index is inflated, while the next DWI is being read
+    void check_dwi(size_t index)
+    {
+        bad_slice_count[index] = get_bad_slices(dwi[index].data(),dim).size();
+        for(size_t i = 0;i < ndc_pairs.size();++i)
+            if(ndc_pairs[i].first == index) // the second always precedes the first
+                ndc[i] = float(tipl::correlation(dwi[index].data(),dwi[index].data()+dim.size(),dwi[ndc_pairs[i].second].data()));
+        if(!dwi_needed[index])
+            std::vector<unsigned short>().swap(dwi[index]);
+    }
+public:
+    tipl::shape<3> dim;
+    tipl::vector<3> vs;
+    std::vector<float> bvalues;
+    std::vector<tipl::vector<3,float> > bvectors;
+    tipl::image<3,unsigned char> mask;
+    std::string error_msg;
+public:
+    float dwi_contrast = 0.0f;
+    std::pair<float,float> ndc_result;
+    size_t bad_slices = 0;
+public:
+    // returns false if the file needs the full ImageModel routine (e.g. no built-in mask)
+    bool run(const std::string& file_name,unsigned int thread_count)
+    {
+        if(!tipl::ends_with(file_name,"src.gz") || !in.open(file_name.c_str()))
+        {
+            error_msg = "unsupported file";
+            return false;
+        }
+        std::future<void> pending;
+        auto finish_pending = [&](void){if(pending.valid()) pending.get();};
+        bool has_mask = false;
+        size_t dwi_loaded = 0;
+        std::string name;
+        uint32_t type = 0;
+        size_t size = 0;
+        std::vector<char> buf;
+        while(read_header(name,type,size))
+        {
+            if(name.size() > 5 && name.substr(0,5) == "image" &&
+               name.find_first_not_of("0123456789",5) == std::string::npos && has_b_table)
+            {
+                size_t index = size_t(std::stoul(name.substr(5)));
+                if(type != 40 || size != dim.size()*sizeof(unsigned short) || index >= dwi.size())
+                {
+                    error_msg = "unsupported DWI storage";
+                    break;
+                }
+                dwi[index].resize(dim.size());
+                if(!in.read(reinterpret_cast<char*>(dwi[index].data()),size))
+                    break;
+                finish_pending();
+                pending = std::async(std::launch::async,[this,index](void){check_dwi(index);});
+                ++dwi_loaded;
+                continue;
+            }
+            if(name == "grad_dev") // signals are corrected with the gradient deviation
+            {
+                error_msg = "gradient deviation correction needed";
+                break;
+            }
+            buf.resize(size);
+            if(size && !in.read(buf.data(),size))
+                break;
+            if(name == "dimension")
+            {
+                std::vector<uint32_t> d;
+                convert(buf,type,d);
+                if(d.size() == 3)
+                    dim = tipl::shape<3>(d[0],d[1],d[2]);
+            }
+            if(name == "voxel_size")
+            {
+                std::vector<float> v;
+                convert(buf,type,v);
+                if(v.size() == 3)
+                    vs = tipl::vector<3>(v[0],v[1],v[2]);
+            }
+            if(name == "b_table" && !has_b_table && dim.size())
+            {
+                std::vector<float> table;
+                convert(buf,type,table);
+                set_b_table(table);
+            }
+            if(name == "mask")
+            {
+                std::vector<unsigned char> m;
+                convert(buf,type,m);
+                mask.resize(dim);
+                if(m.size() == dim.size())
+                    std::copy(m.begin(),m.end(),mask.begin());
+                has_mask = true;
+            }
+        }
+        finish_pending();
+        if(!error_msg.empty() || !has_mask || !has_b_table || dwi_loaded != bvalues.size())
+        {
+            if(error_msg.empty())
+                error_msg = has_mask ? "incomplete SRC file" : "no built-in mask";
+            return false;
+        }
+
+        // masked correlations can only be calculated after the mask is read
+        std::vector<float> masked_ndc(ndc_pairs.size()),self_ndc(dwi_self.size()),self_odc(dwi_self.size());
+        auto correlate = [&](size_t i)
+        {
+            if(i < ndc_pairs.size())
+            {
+                masked_ndc[i] = masked_correlation(dwi[ndc_pairs[i].first].data(),dwi[ndc_pairs[i].second].data(),mask);
+                return;
+            }
+            i -= ndc_pairs.size();
+            self_ndc[i] = masked_correlation(dwi[dwi_self[i]].data(),dwi[dwi_neighbor[i]].data(),mask);
+            self_odc[i] = masked_correlation(dwi[dwi_self[i]].data(),dwi[dwi_ortho[i]].data(),mask);
+        };
+        // a single thread (files checked in parallel) runs serially instead of nesting par_for
+        if(thread_count > 1)
+            tipl::par_for(ndc_pairs.size()+dwi_self.size(),correlate,thread_count);
+        else
+            for(size_t i = 0;i < ndc_pairs.size()+dwi_self.size();++i)
+                correlate(i);
+        std::vector<std::vector<unsigned short> >().swap(dwi);
+
+        dwi_contrast = tipl::mean(self_ndc)/tipl::mean(self_odc);
+        ndc_result = std::make_pair(tipl::mean(ndc),tipl::mean(masked_ndc));
+        bad_slices = std::accumulate(bad_slice_count.begin(),bad_slice_count.end(),size_t(0));
+        return true;
+    }
+};
+
+// single-pass check. returns false, with output untouched, if the file needs the ImageModel path
+bool check_src_stream(std::string file_name,std::vector<std::string>& output,unsigned int thread_count,float& masked_ndc)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    tipl::out() << "checking " << file_name << std::endl;
+    src_qc_stream qc;
+    if(!qc.run(file_name,thread_count))
+    {
+        tipl::out() << "single-pass check not applicable to " << file_name << " (" << qc.error_msg << ")" << std::endl;
+        return false;
+    }
+    std::ostringstream out1,out2;
+    out1 << tipl::vector<3,int>(qc.dim.begin());
+    out2 << qc.vs;
+    output.push_back(QFileInfo(file_name.c_str()).baseName().toStdString());
+    output.push_back(out1.str());
+    output.push_back(out2.str());
+    output.push_back(std::to_string(qc.bvalues.size()));
+    output.push_back(std::to_string(tipl::max_value(qc.bvalues)));
+    output.push_back(std::to_string(qc.dwi_contrast));
+    output.push_back(std::to_string(qc.ndc_result.first));
+    output.push_back(std::to_string(qc.ndc_result.second)); // masked
+    output.push_back(std::to_string(qc.bad_slices));
+    output.push_back(std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::high_resolution_clock::now()-start).count()/1000.0f));
+    masked_ndc = qc.ndc_result.second;
+    return true;
+}
+// loads the entire file. uses tipl::progress and par_for, so call it from the main thread only
 float check_src(std::string file_name,std::vector<std::string>& output) // return masked_ndc
 {
+    auto start = std::chrono::high_resolution_clock::now();
+    auto output_time = [&](void)
+    {
+        output.push_back(std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::high_resolution_clock::now()-start).count()/1000.0f));
+    };
     tipl::out() << "checking " << file_name << std::endl;
     output.push_back(QFileInfo(file_name.c_str()).baseName().toStdString());
     ImageModel handle;
@@ -44,6 +301,7 @@ float check_src(std::string file_name,std::vector<std::string>& output) // retur
     output.push_back(std::to_string(ndc.first));
     output.push_back(std::to_string(ndc.second)); // masked
     output.push_back(std::to_string(handle.get_bad_slices().size()));
+    output_time();
     return ndc.second; // masked ndc
 }
 std::string quality_check_src_files(QString dir)
@@ -73,20 +331,47 @@ std::string quality_check_src_files(QString dir)
     }
     out << src_qc_title << std::endl;
 
+    // check several files concurrently, each file with its own reading thread.
+    // progress is reported from this thread after each batch of files
+    size_t file_count = size_t(filenames.size());
+    size_t file_thread_count = std::min<size_t>(file_count,tipl::max_thread_count);
+    unsigned int thread_per_file = file_thread_count > 1 ? 1 : tipl::max_thread_count;
+    std::vector<std::vector<std::string> > output_all(file_count);
+    std::vector<float> ndc_all(file_count);
+    std::vector<char> need_full_load(file_count);
+    {
+        tipl::progress prog("checking SRC files");
+        for(size_t from = 0;from < file_count && prog(from,file_count);from += file_thread_count)
+        {
+            size_t size = std::min<size_t>(file_thread_count,file_count-from);
+            tipl::par_for(size,[&](size_t j)
+            {
+                size_t i = from+j;
+                need_full_load[i] = !check_src_stream(filenames[int(i)].toStdString(),output_all[i],thread_per_file,ndc_all[i]);
+            },size);
+        }
+        if(prog.aborted())
+            return std::string();
+    }
+    // files the single pass cannot handle are loaded one at a time outside the parallel loop
+    for(size_t i = 0;i < need_full_load.size();++i)
+        if(need_full_load[i])
+        {
+            tipl::out() << "loading the entire file " << filenames[int(i)].toStdString() << std::endl;
+            ndc_all[i] = check_src(filenames[int(i)].toStdString(),output_all[i]);
+        }
+
     std::vector<std::vector<std::string> > output;
     std::vector<float> ndc;
-    tipl::progress prog("checking SRC files");
-    for(int i = 0;prog(i,filenames.size());++i)
+    for(size_t i = 0;i < output_all.size();++i)
     {
-        std::vector<std::string> output_each;
-        float mask_ndc_each = check_src(filenames[i].toStdString(),output_each);
-        if(mask_ndc_each == 0.0f)
+        if(ndc_all[i] == 0.0f)
         {
-            out << "cannot load SRC file " << filenames[i].toStdString() << std::endl;
+            out << "cannot load SRC file " << filenames[int(i)].toStdString() << std::endl;
             continue;
         }
-        output.push_back(std::move(output_each));
-        ndc.push_back(mask_ndc_each);
+        output.push_back(std::move(output_all[i]));
+        ndc.push_back(ndc_all[i]);
     }
     auto ndc_copy = ndc;
     float m = tipl::median(ndc_copy.begin(),ndc_copy.end());
@@ -151,6 +436,7 @@ std::string quality_check_fib_files(QString dir)
 int qc(tipl::program_option<tipl::out>& po)
 {
     std::string file_name = po.get("source");
+    tipl::max_thread_count = po.get("thread_count",tipl::max_thread_count);
     if(QFileInfo(file_name.c_str()).isDir())
     {
         {
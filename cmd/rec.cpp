@@ -30,10 +30,19 @@ int rec(tipl::program_option<tipl::out>& po)
         src.voxel.method_id = uint8_t(po.get("method",4));
         src.voxel.odf_resolving = po.get("odf_resolving",int(0));
         src.voxel.output_odf = po.get("record_odf",int(0));
+        src.voxel.odf_spill_bits = uint8_t(po.get("odf_spill",int(0)));
+        if(src.voxel.odf_spill_bits != 0 && src.voxel.odf_spill_bits != 8 &&
+           src.voxel.odf_spill_bits != 16 && src.voxel.odf_spill_bits != 32)
+        {
+            tipl::out() << "ERROR: --odf_spill should be 0, 8, 16, or 32" << std::endl;
+            return 1;
+        }
         src.voxel.dti_no_high_b = po.get("dti_no_high_b",src.is_human_data());
         src.voxel.other_output = po.get("other_output","fa,ad,rd,md,iso,rdi");
         src.voxel.r2_weighted = po.get("r2_weighted",int(0));
         src.voxel.thread_count = tipl::max_thread_count = po.get("thread_count",tipl::max_thread_count);
+        src.voxel.profile_file = po.get("profile_file","");
+        src.voxel.profile = po.get("profile",int(!src.voxel.profile_file.empty()));
         src.voxel.param[0] = po.get("param0",src.voxel.param[0]);
         src.voxel.param[1] = po.get("param1",src.voxel.param[1]);
         src.voxel.param[2] = po.get("param2",src.voxel.param[2]);
@@ -7,6 +7,7 @@ void dicom2src_and_nii(std::string dir_);
 int ren(tipl::program_option<tipl::out>& po)
 {
     tipl::progress prog("run ren");
+    tipl::max_thread_count = po.get("thread_count",tipl::max_thread_count);
     auto source = std::filesystem::path(po.get("source")).string();
     auto output = std::filesystem::path(po.get("output",po.get("source"))).string();
     auto subject_dir = rename_dicom_at_dir(source.c_str(),output.c_str());
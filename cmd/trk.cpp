@@ -58,6 +58,27 @@ bool export_track_info(tipl::program_option<tipl::out>& po,std::shared_ptr<fib_d
                        std::string file_name,
                        std::shared_ptr<TractModel> tract_model)
 {
+    // sample all metrics used by the reports in one pass
+    std::vector<unsigned int> report_index;
+    std::vector<std::vector<float> > report_data;
+    {
+        std::istringstream in(po.get("export"));
+        std::string cmd;
+        while(std::getline(in,cmd,','))
+        {
+            if(cmd.find("report") != 0)
+                continue;
+            std::replace(cmd.begin(),cmd.end(),':',' ');
+            std::string report_tag,index_name;
+            std::istringstream(cmd) >> report_tag >> index_name;
+            auto index_num = uint32_t(handle->get_name_index(index_name));
+            if(index_num != handle->view_item.size() &&
+               std::find(report_index.begin(),report_index.end(),index_num) == report_index.end())
+                report_index.push_back(index_num);
+        }
+        if(report_index.size() > 1)
+            tract_model->get_tracts_data(handle,report_index,report_data);
+    }
     std::istringstream in(po.get("export"));
     std::string cmd;
     while(std::getline(in,cmd,','))
@@ -92,7 +113,17 @@ bool export_track_info(tipl::program_option<tipl::out>& po,std::shared_ptr<fib_d
             tipl::out() << "profile_dir: " << profile_dir << std::endl;
             tipl::out() << "bandwidth: " << bandwidth << std::endl;
             tipl::out() << "index_name: " << index_name << std::endl;
-            tract_model->get_report(
+            auto metric = std::find(report_index.begin(),report_index.end(),
+                                    uint32_t(handle->get_name_index(index_name)))-report_index.begin();
+            if(!report_data.empty() && metric < int(report_index.size()))
+            {
+                std::vector<std::vector<float> > data;
+                TractModel::get_metric_data(report_data,report_index.size(),size_t(metric),data);
+                tract_model->get_report(profile_dir,bandwidth,std::move(data),
+                                        values,data_profile,data_ci1,data_ci2);
+            }
+            else
+                tract_model->get_report(
                                 handle,
                                 profile_dir,
                                 bandwidth,
@@ -139,6 +170,7 @@ bool export_track_info(tipl::program_option<tipl::out>& po,std::shared_ptr<fib_d
 
             bool output_color = QString(cmd.c_str()).contains("color");
             bool output_end = QString(cmd.c_str()).contains("end");
+            bool output_length = QString(cmd.c_str()).contains("length");
             file_name_stat += ".nii.gz";
             tipl::matrix<4,4> to_t1t2,trans_to_mni;
             tipl::shape<3> dim;
@@ -173,11 +205,13 @@ bool export_track_info(tipl::program_option<tipl::out>& po,std::shared_ptr<fib_d
                 tipl::out() << " in RGB color";
             if(output_end)
                 tipl::out() << " end point only";
+            if(output_length)
+                tipl::out() << " as mean tract length";
             tipl::out() << std::endl;
             tipl::out() << "TDI dimension: " << dim << std::endl;
             tipl::out() << "TDI voxel size: " << vs << std::endl;
             tipl::out() << std::endl;
-            if(!TractModel::export_tdi(file_name_stat.c_str(),tract,dim,vs,trans_to_mni,to_t1t2,output_color,output_end))
+            if(!TractModel::export_tdi(file_name_stat.c_str(),tract,dim,vs,trans_to_mni,to_t1t2,output_color,output_end,output_length))
             {
                 tipl::out() << "ERROR: failed to save file. Please check write permission." << std::endl;
                 return false;
@@ -382,11 +416,37 @@ std::shared_ptr<fib_data> cmd_load_fib(std::string file_name)
     }
     return handle;
 }
+// metrics needed by --export are decompressed in the background while tracts and regions are loaded
+void prefetch_export_metrics(tipl::program_option<tipl::out>& po,std::shared_ptr<fib_data> handle)
+{
+    if(!po.has("export"))
+        return;
+    std::vector<std::string> names;
+    std::istringstream in(po.get("export"));
+    std::string cmd;
+    while(std::getline(in,cmd,','))
+    {
+        if(cmd == "stat")
+        {
+            for(const auto& each : handle->view_item)
+                names.push_back(each.name);
+            continue;
+        }
+        if(cmd.find("report") == 0) // report:index_name:profile_dir:bandwidth
+        {
+            std::replace(cmd.begin(),cmd.end(),':',' ');
+            std::istringstream(cmd) >> cmd >> cmd;
+        }
+        names.push_back(cmd);
+    }
+    handle->prefetch_items(names);
+}
 std::shared_ptr<fib_data> cmd_load_fib(tipl::program_option<tipl::out>& po)
 {
     auto handle = cmd_load_fib(po.get("source"));
     if(!handle.get() || !check_other_slices(po,handle))
         return std::shared_ptr<fib_data>();
+    prefetch_export_metrics(po,handle);
     return handle;
 }
 bool load_region(tipl::program_option<tipl::out>& po,std::shared_ptr<fib_data> handle,
@@ -495,6 +555,19 @@ int trk_post(tipl::program_option<tipl::out>& po,
         tract_model->delete_repeated(distance);
         tipl::out() << "repeat tracks with distance smaller than " << distance <<" voxel distance are deleted" << std::endl;
     }
+    if(po.has("resample"))
+    {
+        float step = po.get("resample",float(0.5f));
+        bool catmull_rom = po.get("resample_spline",0);
+        tipl::out() << "resampling tracks to a step size of " << step << " voxels" << (catmull_rom ? " using Catmull-Rom interpolation" : "") << std::endl;
+        tract_model->resample(step,catmull_rom);
+    }
+    if(po.has("smooth_tract"))
+    {
+        float sigma = po.get("smooth_tract",float(1.0f));
+        tipl::out() << "smoothing tracks with a Gaussian kernel of sigma " << sigma << " points" << std::endl;
+        tract_model->smooth(sigma);
+    }
     if(po.has("cluster"))
     {
         std::string cmd = po.get("cluster");
@@ -471,6 +471,7 @@ void group_connectometry::on_show_result_clicked()
         stat_model info;
         info.resample(*(vbc->model.get()),false,false,0);
         vbc->calculate_spm(*result_fib.get(),info);
+        new_data->wait_prefetch();
         new_data->view_item.push_back(item("dec_t",result_fib->dec_ptr[0],new_data->dim));
         new_data->view_item.push_back(item("inc_t",result_fib->inc_ptr[0],new_data->dim));
     }
@@ -1,4 +1,5 @@
 #include <unordered_map>
+#include <atomic>
 #include <qmessagebox.h>
 #include <QProgressDialog>
 #include <QFileDialog>
@@ -573,91 +574,95 @@ bool load_multiple_slice_dicom(QStringList file_list,std::vector<std::shared_ptr
     if(file_list.size() < 2 || !dicom_header2.load_from_file(file_list[1].toStdString().c_str()))
         return false;
     tipl::out()  << "handled as multiple single slice DWI";
+
+    // each file is parsed only once, concurrently, and the layout is worked out from the parsed headers
+    std::vector<std::shared_ptr<DwiHeader> > slices(file_list.size());
+    {
+        // the first two headers are already loaded
+        slices[0] = std::make_shared<DwiHeader>();
+        slices[1] = std::make_shared<DwiHeader>();
+        if(!slices[0]->open(dicom_header) || !slices[1]->open(dicom_header2))
+            return false;
+
+        // files are read in batches so that progress is reported from this thread
+        tipl::progress prog("reading multiple slices DWI");
+        std::atomic<bool> failed(false);
+        const size_t batch_size = 64;
+        for(size_t from = 2;from < slices.size() && !failed && prog(from,slices.size());from += batch_size)
+        {
+            size_t size = std::min<size_t>(batch_size,slices.size()-from);
+            tipl::par_for(size,[&](size_t j)
+            {
+                std::shared_ptr<DwiHeader> dwi(new DwiHeader);
+                if(!dwi->open(file_list[int(from+j)].toStdString().c_str()))
+                {
+                    failed = true;
+                    return;
+                }
+                slices[from+j] = dwi;
+            },std::min<size_t>(size,tipl::max_thread_count));
+        }
+        if(failed || prog.aborted())
+            return false;
+    }
+
     float s1 = dicom_header.get_slice_location();
     bool iterate_slice_first = true;
     unsigned int slice_num = 2;
     unsigned int b_num = 2;
-    if(s1 == 0.0) // no slice location information
+    if(s1 == 0.0f) // no slice location information
     {
-        DwiHeader dwi1,dwi2;
-        dwi1.open(file_list[0].toStdString().c_str());
-        dwi2.open(file_list[1].toStdString().c_str());
-        if(dwi1.bvec == dwi2.bvec && dwi1.bvalue == dwi2.bvalue) // iterate slice first
+        auto same_b = [&](size_t i)
         {
-            for (;slice_num < file_list.size();++slice_num)
-            {
-                DwiHeader dwi;
-                if(!dwi.open(file_list[slice_num].toStdString().c_str()))
-                    return false;
-                if(dwi1.bvec != dwi.bvec || dwi1.bvalue != dwi.bvalue)
-                    break;
-            }
+            return slices[0]->bvec == slices[i]->bvec && slices[0]->bvalue == slices[i]->bvalue;
+        };
+        if(same_b(1)) // iterate slice first
+        {
+            for (;slice_num < slices.size() && same_b(slice_num);++slice_num)
+                ;
             geo[2] = slice_num;
             iterate_slice_first = true;
         }
         else
         // iterate b first
         {
-            for (;b_num < file_list.size();++b_num)
-            {
-                DwiHeader dwi;
-                if(!dwi.open(file_list[b_num].toStdString().c_str()))
-                    return false;
-                if(dwi1.bvec == dwi.bvec && dwi1.bvalue == dwi.bvalue)
-                    break;
-            }
-            geo[2] = file_list.size()/b_num;
+            for (;b_num < slices.size() && !same_b(b_num);++b_num)
+                ;
+            geo[2] = slices.size()/b_num;
             iterate_slice_first = false;
         }
     }
     else
     {
-        if(s1 == dicom_header2.get_slice_location()) // iterate b-value first
+        if(s1 == slices[1]->slice_location) // iterate b-value first
         {
-            for (;b_num < file_list.size();++b_num)
-            {
-                if(!dicom_header2.load_from_file(file_list[b_num].toStdString().c_str()))
-                    return false;
-                if(dicom_header2.get_slice_location() != s1)
-                    break;
-            }
-            geo[2] = std::ceil(float(file_list.size())/float(b_num));
+            for (;b_num < slices.size() && slices[b_num]->slice_location == s1;++b_num)
+                ;
+            geo[2] = std::ceil(float(slices.size())/float(b_num));
             iterate_slice_first = false;
         }
         else
         // iterate slice first
         {
-            for (;slice_num < file_list.size();++slice_num)
-            {
-                if(!dicom_header2.load_from_file(file_list[slice_num].toStdString().c_str()))
-                    return false;
-                if(dicom_header2.get_slice_location() == s1)
-                    break;
-            }
+            for (;slice_num < slices.size() && slices[slice_num]->slice_location != s1;++slice_num)
+                ;
             geo[2] = slice_num;
             iterate_slice_first = true;
         }
     }
-    tipl::progress prog("reading multiple slices DWI");
-    for (unsigned int index = 0,b_index = dwi_files.size(),slice_index = 0;prog(index,file_list.size());++index)
+
+    // the first slice of each volume holds the volume, other slices are copied into it
+    std::vector<std::pair<size_t,size_t> > slice_pos(slices.size()); // volume, slice
+    for (unsigned int index = 0,b_index = dwi_files.size(),slice_index = 0;index < slices.size();++index)
     {
-        std::shared_ptr<DwiHeader> dwi(new DwiHeader);
-        if(!dwi->open(file_list[index].toStdString().c_str()))
-            return false;
+        slice_pos[index] = std::make_pair(b_index,slice_index);
         if(slice_index == 0)
         {
-            dwi_files.push_back(dwi);
-            dwi_files.back()->file_name = file_list[index].toStdString().c_str();
+            dwi_files.push_back(slices[index]);
+            dwi_files.back()->file_name = file_list[int(index)].toStdString().c_str();
             dwi_files.back()->image.resize(geo);
             dicom_header.get_voxel_size(dwi_files.back()->voxel_size);
         }
-        else
-        {
-            size_t pos = slice_index*geo.plane_size();
-            if(pos+dwi->image.size() > dwi_files[b_index]->image.size())
-                return false;
-            std::copy(dwi->image.begin(),dwi->image.end(),dwi_files[b_index]->image.begin() + pos);
-        }
         if(iterate_slice_first)
         {
             ++slice_index;
@@ -677,7 +682,22 @@ bool load_multiple_slice_dicom(QStringList file_list,std::vector<std::shared_ptr
             }
         }
     }
-    return !prog.aborted();
+    std::atomic<bool> out_of_bound(false);
+    tipl::par_for(slices.size(),[&](size_t index)
+    {
+        if(!slice_pos[index].second)
+            return;
+        size_t pos = slice_pos[index].second*geo.plane_size();
+        if(slice_pos[index].first >= dwi_files.size() ||
+           pos+slices[index]->image.size() > dwi_files[slice_pos[index].first]->image.size())
+        {
+            out_of_bound = true;
+            return;
+        }
+        std::copy(slices[index]->image.begin(),slices[index]->image.end(),
+                  dwi_files[slice_pos[index].first]->image.begin() + pos);
+    });
+    return !out_of_bound;
 }
 void scale_image_buf_to_uint16(std::vector<tipl::image<3> >& image_buf)
 {
@@ -59,7 +59,11 @@ bool DwiHeader::open(const char* filename)
         file_name = filename;
         return true;
     }
-
+    return open(header);
+}
+// a header that is already loaded
+bool DwiHeader::open(tipl::io::dicom& header)
+{
     header >> image;
     if(header.is_compressed)
     {
@@ -92,6 +96,7 @@ bool DwiHeader::open(const char* filename)
 
     // get TE
     te = header.get_te();
+    slice_location = header.get_slice_location();
 
     float bx,by,bz;
     if(!header.get_btable(bvalue,bvec[0],bvec[1],bvec[2]))
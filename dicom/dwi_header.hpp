@@ -18,10 +18,12 @@ public:// for HCP dataset
 public:
     tipl::vector<3,float> bvec;
     float bvalue,te;
+    float slice_location = 0.0f;
     tipl::vector<3,float> voxel_size;
 public:
     DwiHeader(void): bvalue(0.0f), te(0.0f) {}
     bool open(const char* filename);
+    bool open(tipl::io::dicom& header);
 public:
     const unsigned short* begin(void) const
     {
@@ -59,10 +59,14 @@ HEADERS += mainwindow.h \
     tracking/region/regiontablewidget.h \
     tracking/region/Regions.h \
     libs/tracking/tract_model.hpp \
+    libs/tracking/tract_lod.hpp \
+    libs/tracking/tract_density.hpp \
+    libs/tracking/tract_resample.hpp \
     tracking/tract/tracttablewidget.h \
     qcolorcombobox.h \
     libs/tracking/tracking_thread.hpp \
     libs/mapping/atlas.hpp \
+    libs/mapping/mapping_cache.hpp \
     view_image.h \
     manual_alignment.h \
     tracking/tract_report.hpp \
@@ -127,12 +131,16 @@ SOURCES += main.cpp \
     tracking/region/regiontablewidget.cpp \
     tracking/region/Regions.cpp \
     libs/tracking/tract_model.cpp \
+    libs/tracking/tract_lod.cpp \
+    libs/tracking/tract_density.cpp \
+    libs/tracking/tract_resample.cpp \
     tracking/tract/tracttablewidget.cpp \
     qcolorcombobox.cpp \
     cmd/trk.cpp \
     cmd/rec.cpp \
     cmd/src.cpp \
     libs/mapping/atlas.cpp \
+    libs/mapping/mapping_cache.cpp \
     cmd/ana.cpp \
     view_image.cpp \
     manual_alignment.cpp \
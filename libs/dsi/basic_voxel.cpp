@@ -1,3 +1,7 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <numeric>
 #include "basic_voxel.hpp"
 #include "image_model.hpp"
 
@@ -22,10 +26,14 @@ bool Voxel::init(void)
             voxel_data[index].dir.resize(max_fiber_number);
         }
     }
+    // processes size their per-si data from si2vi, and a process may change the mask (e.g. DWINormalization),
+    // so si2vi is rebuilt after each init for the processes that follow
+    update_si2vi();
     for (unsigned int index = 0; prog(index,process_list.size()); ++index)
     {
         tipl::out() << process_name[index];
         process_list[index]->init(*this);
+        update_si2vi();
     }
     return !prog.aborted();
 }
@@ -110,36 +118,115 @@ bool Voxel::run_hist(void)
             to_list.push_back(to);
         }
 
-    size_t p = 0;
+    // tissue coverage of each tile from the downsampled mask
+    std::vector<size_t> coverage(from_list.size());
+    {
+        float rx = float(mask.width()-1)/float(hist_image.width()-1);
+        float ry = float(mask.height()-1)/float(hist_image.height()-1);
+        tipl::par_for(from_list.size(),[&](size_t i)
+        {
+            int x0 = int(float(from_list[i][0])*rx),x1 = std::min<int>(mask.width()-1,int(float(to_list[i][0])*rx));
+            int y0 = int(float(from_list[i][1])*ry),y1 = std::min<int>(mask.height()-1,int(float(to_list[i][1])*ry));
+            for(int y = y0;y <= y1;++y)
+                for(int x = x0;x <= x1;++x)
+                    if(mask.at(uint32_t(x),uint32_t(y)))
+                        ++coverage[i];
+        });
+    }
+    // tiles without tissue produce zero output and are skipped,
+    // the rest are taken from a shared queue with the most tissue first
+    std::vector<size_t> order;
+    for(size_t i = 0;i < from_list.size();++i)
+        if(coverage[i])
+            order.push_back(i);
+    std::stable_sort(order.begin(),order.end(),[&](size_t a,size_t b){return coverage[a] > coverage[b];});
+    tipl::out() << order.size() << " of " << from_list.size() << " tiles contain tissue" << std::endl;
+
+    std::atomic<size_t> next(0),p(0);
     tipl::par_for(thread_count,[&](size_t thread_id)
     {
         hist_data[thread_id].init();
-        for(size_t i = thread_id;i < from_list.size() && prog(p++,from_list.size());i += thread_count)
+        for(size_t i = next++;i < order.size() && prog(p++,order.size());i = next++)
         {
-            hist_data[thread_id].from = from_list[i];
-            hist_data[thread_id].to = to_list[i];
+            hist_data[thread_id].from = from_list[order[i]];
+            hist_data[thread_id].to = to_list[order[i]];
             for (unsigned int j = 0; j < process_list.size(); ++j)
                 process_list[j]->run_hist(*this,hist_data[thread_id]);
         }
     });
     return !prog.aborted();
 }
+void Voxel::output_profile(const char* title,const std::vector<double>& ns,const std::vector<size_t>& count,double total_ns)
+{
+    double sum_ns = std::accumulate(ns.begin(),ns.end(),0.0);
+    tipl::out() << "profile of " << title << ": " << total_ns*1.0e-9 << " s wall time, "
+                << thread_count << " threads" << std::endl;
+    std::ostringstream json;
+    json << "{\"title\":\"" << title << "\",\"wall_time_s\":" << total_ns*1.0e-9
+         << ",\"thread_count\":" << thread_count << ",\"process\":[";
+    for(size_t i = 0;i < process_list.size();++i)
+    {
+        tipl::out() << process_name[i] << ": " << ns[i]*1.0e-6 << " ms (" << int(100.0*ns[i]/std::max(1.0,sum_ns)) << "%), "
+                    << count[i] << " voxels, " << (count[i] ? ns[i]/double(count[i]) : 0.0) << " ns/voxel" << std::endl;
+        json << (i ? "," : "") << "{\"name\":\"" << process_name[i] << "\",\"time_ms\":" << ns[i]*1.0e-6
+             << ",\"voxel_count\":" << count[i] << "}";
+    }
+    json << "]}";
+    profile_passes.push_back(json.str());
+    if(profile_file.empty())
+        return;
+    std::ofstream out(profile_file.c_str());
+    out << "[" << std::endl;
+    for(size_t i = 0;i < profile_passes.size();++i)
+        out << profile_passes[i] << (i+1 < profile_passes.size() ? "," : "") << std::endl;
+    out << "]" << std::endl;
+    if(!out)
+        tipl::out() << "cannot write profile to " << profile_file << std::endl;
+}
 bool Voxel::run(const char* title)
 {
     tipl::progress prog(title,true);
-    size_t total_size = 0;
+    std::atomic<size_t> total_size(0);
+    // each thread accumulates its own timing, merged after the loop
+    std::vector<std::vector<double> > thread_ns(profile ? thread_count : 0,std::vector<double>(process_list.size()));
+    std::vector<std::vector<size_t> > thread_count_(profile ? thread_count : 0,std::vector<size_t>(process_list.size()));
+    auto begin_time = std::chrono::steady_clock::now();
     tipl::par_for(thread_count,[&](size_t thread_id)
     {
-        for(size_t voxel_index = thread_id;voxel_index < mask.size() && prog(total_size++,mask.size());voxel_index += thread_count)
+        for(size_t si = thread_id;si < si2vi.size() && prog(total_size++,si2vi.size());si += thread_count)
         {
-            if(!mask[voxel_index])
-                continue;
             voxel_data[thread_id].init();
-            voxel_data[thread_id].voxel_index = voxel_index;
+            voxel_data[thread_id].voxel_index = si2vi[si];
+            voxel_data[thread_id].si = si;
+            if(profile)
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                for (size_t index = 0; index < process_list.size(); ++index)
+                {
+                    process_list[index]->run(*this,voxel_data[thread_id]);
+                    auto t1 = std::chrono::steady_clock::now();
+                    thread_ns[thread_id][index] += std::chrono::duration<double,std::nano>(t1-t0).count();
+                    ++thread_count_[thread_id][index];
+                    t0 = t1;
+                }
+                continue;
+            }
             for (size_t index = 0; index < process_list.size(); ++index)
                 process_list[index]->run(*this,voxel_data[thread_id]);
         }
     },thread_count);
+    if(profile && !prog.aborted())
+    {
+        std::vector<double> ns(process_list.size());
+        std::vector<size_t> count(process_list.size());
+        for(size_t i = 0;i < thread_ns.size();++i)
+            for(size_t j = 0;j < process_list.size();++j)
+            {
+                ns[j] += thread_ns[i][j];
+                count[j] += thread_count_[i][j];
+            }
+        output_profile(title,ns,count,std::chrono::duration<double,std::nano>(std::chrono::steady_clock::now()-begin_time).count());
+    }
     return !prog.aborted();
 }
 
@@ -28,6 +28,7 @@ public:
 struct VoxelData
 {
     size_t voxel_index;
+    size_t si; // index among masked voxels
     std::vector<float> space;
     std::vector<float> odf;
     std::vector<float> odf1,odf2;
@@ -38,6 +39,9 @@ struct VoxelData
     float min_odf;
     tipl::matrix<3,3,float> jacobian;
     tipl::matrix<3,3,float> grad_dev;
+public: // per-thread QSDR reconstruction kernel and the jacobian it was rotated by
+    std::vector<float> sinc_ql;
+    tipl::matrix<3,3,float> sinc_ql_jacobian;
 
     void init(void)
     {
@@ -53,7 +57,7 @@ public:
     tipl::image<2,unsigned char> I,I_mask;
     tipl::vector<2,int> from,to;
 public:
-    enum {dx = 0,dy = 1,dxx = 2,dyy = 3,dxy = 4};
+    enum {dx = 0,dy = 1,dxx = 2,dyy = 3,dxy = 4,dxy_full = 5};
     std::vector<tipl::image<2> > other_maps;
 public:
     void init(void)
@@ -77,10 +81,32 @@ public:
 public:
 
     tipl::image<3,unsigned char> mask;
+public: // masked voxels in a compacted index space, kept current through init()
+    std::vector<size_t> si2vi;
+    void update_si2vi(void)
+    {
+        si2vi.clear();
+        for(size_t index = 0;index < mask.size();++index)
+            if(mask[index])
+                si2vi.push_back(index);
+    }
+    // per-si results are expanded to whole volumes only when written
+    template<typename T>
+    std::vector<T> expand_masked(const std::vector<T>& si_data,size_t volume_size) const
+    {
+        std::vector<T> result;
+        if(si_data.empty())
+            return result;
+        result.resize(volume_size);
+        for(size_t si = 0;si < si2vi.size() && si < si_data.size();++si)
+            result[si2vi[si]] = si_data[si];
+        return result;
+    }
 public:
     std::vector<const unsigned short*> dwi_data;
     std::vector<tipl::vector<3,float> > bvectors;
     std::vector<float> bvalues;
+public:
 
     std::string report,steps;
     std::ostringstream recon_report, step_report;
@@ -93,6 +119,7 @@ public:
 public:
     std::string file_name;
     bool output_odf = false;
+    unsigned char odf_spill_bits = 0; // 0: ODFs kept in memory, 8/16: quantized, 32: float blocks in a temporary file
     unsigned int max_fiber_number = 3;
     std::vector<std::string> file_list;
 public:
@@ -157,6 +184,11 @@ public:// for template creation
 public:
     std::vector<VoxelData> voxel_data;
     std::vector<HistData> hist_data;
+public: // per-process timing in run()
+    bool profile = false;
+    std::string profile_file; // JSON report of all passes, optional
+    std::vector<std::string> profile_passes;
+    void output_profile(const char* title,const std::vector<double>& ns,const std::vector<size_t>& count,double total_ns);
 public:
     template<typename T,typename ...Ts>
     void add_process(void)
@@ -3,6 +3,52 @@
 #include <cmath>
 #include "basic_voxel.hpp"
 
+// closed-form eigen decomposition of a symmetric 3-by-3 matrix (row-major)
+// eigenvalues are sorted in descending order and V stores the eigenvectors in rows
+// returns false when eigenvalues are too close for the eigenvectors to be stable
+inline bool eigen_decomposition_sym3(const double* A,double* V,double* d)
+{
+    double p1 = A[1]*A[1]+A[2]*A[2]+A[5]*A[5];
+    double q = (A[0]+A[4]+A[8])/3.0;
+    double p = std::sqrt(((A[0]-q)*(A[0]-q)+(A[4]-q)*(A[4]-q)+(A[8]-q)*(A[8]-q)+2.0*p1)/6.0);
+    if(p1 == 0.0 || p == 0.0 || !std::isfinite(p))
+        return false;
+    double b00 = (A[0]-q)/p,b11 = (A[4]-q)/p,b22 = (A[8]-q)/p;
+    double b01 = A[1]/p,b02 = A[2]/p,b12 = A[5]/p;
+    double r = 0.5*(b00*(b11*b22-b12*b12)-b01*(b01*b22-b12*b02)+b02*(b01*b12-b11*b02));
+    double phi = std::acos(std::min(1.0,std::max(-1.0,r)))/3.0;
+    d[0] = q+2.0*p*std::cos(phi);
+    d[2] = q+2.0*p*std::cos(phi+2.0*3.14159265358979323846/3.0);
+    d[1] = 3.0*q-d[0]-d[2];
+    if(d[0]-d[1] < 1.0e-3*p || d[1]-d[2] < 1.0e-3*p)
+        return false;
+    // eigenvector: the largest cross product between rows of A-dI
+    auto get_vector = [&](double l,double* v)
+    {
+        double r0[3] = {A[0]-l,A[1],A[2]},r1[3] = {A[3],A[4]-l,A[5]},r2[3] = {A[6],A[7],A[8]-l};
+        double c[3][3] = {{r0[1]*r1[2]-r0[2]*r1[1],r0[2]*r1[0]-r0[0]*r1[2],r0[0]*r1[1]-r0[1]*r1[0]},
+                          {r0[1]*r2[2]-r0[2]*r2[1],r0[2]*r2[0]-r0[0]*r2[2],r0[0]*r2[1]-r0[1]*r2[0]},
+                          {r1[1]*r2[2]-r1[2]*r2[1],r1[2]*r2[0]-r1[0]*r2[2],r1[0]*r2[1]-r1[1]*r2[0]}};
+        double n[3] = {c[0][0]*c[0][0]+c[0][1]*c[0][1]+c[0][2]*c[0][2],
+                       c[1][0]*c[1][0]+c[1][1]*c[1][1]+c[1][2]*c[1][2],
+                       c[2][0]*c[2][0]+c[2][1]*c[2][1]+c[2][2]*c[2][2]};
+        unsigned int m = (n[0] > n[1]) ? (n[0] > n[2] ? 0 : 2) : (n[1] > n[2] ? 1 : 2);
+        if(!(n[m] > 1.0e-12*p*p*p*p))
+            return false;
+        double len = std::sqrt(n[m]);
+        v[0] = c[m][0]/len;
+        v[1] = c[m][1]/len;
+        v[2] = c[m][2]/len;
+        return true;
+    };
+    if(!get_vector(d[0],V) || !get_vector(d[2],V+6))
+        return false;
+    V[3] = V[7]*V[2]-V[8]*V[1];
+    V[4] = V[8]*V[0]-V[6]*V[2];
+    V[5] = V[6]*V[1]-V[7]*V[0];
+    return true;
+}
+
 class Dwi2Tensor : public BaseProcess
 {
     std::vector<float> ad,rd,rd1,rd2,md,txx,txy,txz,tyy,tyz,tzz,ha;
@@ -35,26 +81,28 @@ public:
         voxel.fib_dir.clear();
         voxel.fib_dir.resize(voxel.dim.size());
 
+        // other metrics are stored by masked voxel index (si) and expanded when written
+        size_t si_count = voxel.si2vi.size();
         if(voxel.needs("md"))
-            md.resize(voxel.dim.size());
+            md.assign(si_count,0.0f);
         if(voxel.needs("ad"))
-            ad.resize(voxel.dim.size());
+            ad.assign(si_count,0.0f);
         if(voxel.needs("rd"))
-            rd.resize(voxel.dim.size());
+            rd.assign(si_count,0.0f);
         if(voxel.needs("rd1"))
-            rd1.resize(voxel.dim.size());
+            rd1.assign(si_count,0.0f);
         if(voxel.needs("rd2"))
-            rd2.resize(voxel.dim.size());
+            rd2.assign(si_count,0.0f);
         if(voxel.needs("helix"))
-            ha.resize(voxel.dim.size());
+            ha.assign(si_count,0.0f);
         if(voxel.needs("tensor"))
         {
-            txx.resize(voxel.dim.size());
-            txy.resize(voxel.dim.size());
-            txz.resize(voxel.dim.size());
-            tyy.resize(voxel.dim.size());
-            tyz.resize(voxel.dim.size());
-            tzz.resize(voxel.dim.size());
+            txx.assign(si_count,0.0f);
+            txy.assign(si_count,0.0f);
+            txz.assign(si_count,0.0f);
+            tyy.assign(si_count,0.0f);
+            tyz.assign(si_count,0.0f);
+            tzz.assign(si_count,0.0f);
         }
 
         // the first DWI should be b0
@@ -118,22 +166,25 @@ public:
     {
         if(voxel.fib_fa.empty() || data.space.front() == 0.0f)
             return;
-        std::vector<double> signal(b_count);
+        //  Kt S = Kt K D, accumulated while taking the log so that no per-voxel buffer is needed
+        double KtS[6] = {0.0,0.0,0.0,0.0,0.0,0.0},tensor_param[6];
+        double tensor[9];
+        double V[9],d[3];
         {
-            double logs0 = std::log(std::max<double>(1.0,double(data.space.front())));
+            // log is monotonic: the maximum log signal is the log of the maximum signal
+            float max_s = std::max<float>(1.0f,data.space.front());
             for (size_t i = 0;i < b_count;++i)
-                signal[i] = std::log(std::max<double>(1.0,double(data.space[b_location[i]])));
-            logs0 = std::max<double>(logs0,tipl::max_value(signal));
-            if(logs0 == 0.0)
+                max_s = std::max<float>(max_s,data.space[b_location[i]]);
+            float logs0 = std::log(max_s);
+            if(logs0 == 0.0f)
                 return;
             for (size_t i = 0;i < b_count;++i)
-                signal[i] = std::max<double>(0.0,logs0-signal[i]);
+            {
+                double signal = double(std::max<float>(0.0f,logs0-std::log(std::max<float>(1.0f,data.space[b_location[i]]))));
+                for (size_t j = 0,index = i;j < 6;++j,index += b_count)
+                    KtS[j] += Kt[index]*signal;
+            }
         }
-        //  Kt S = Kt K D
-        double KtS[6],tensor_param[6];
-        double tensor[9];
-        double V[9],d[3];
-        tipl::mat::product(Kt.begin(),signal.begin(),KtS,tipl::shape<2>(6,b_count),tipl::shape<2>(b_count,1));
         for(unsigned int i = 0;i < iKtK.size();++i)
         {
             if(!tipl::mat::lu_solve(iKtK[i].begin(),iKtK_pivot[i].begin(),KtS,tensor_param,tipl::shape<2>(6,6)))
@@ -141,7 +192,9 @@ public:
             unsigned int tensor_index[9] = {0,3,4,3,1,5,4,5,2};
             for (unsigned int index = 0; index < 9; ++index)
                 tensor[index] = tensor_param[tensor_index[index]];
-            tipl::mat::eigen_decomposition_sym(tensor,V,d,tipl::dim<3,3>());
+            // near-degenerate tensors fall back to the iterative solver
+            if(!eigen_decomposition_sym3(tensor,V,d))
+                tipl::mat::eigen_decomposition_sym(tensor,V,d,tipl::dim<3,3>());
             if(d[0] > 0.0 && d[1] > 0.0 && d[2] > 0.0)
                 break;
         }
@@ -154,33 +207,33 @@ public:
         voxel.fib_fa[data.voxel_index] = get_fa(float(d[0]),float(d[1]),float(d[2]));
 
         if(!md.empty())
-            md[data.voxel_index] = 1000.0f*float(d[0]+d[1]+d[2])/3.0f;
+            md[data.si] = 1000.0f*float(d[0]+d[1]+d[2])/3.0f;
         if(!ad.empty())
-            ad[data.voxel_index] = 1000.0f*float(d[0]);
+            ad[data.si] = 1000.0f*float(d[0]);
         if(!rd1.empty())
-            rd1[data.voxel_index] = 1000.0f*float(d[1]);
+            rd1[data.si] = 1000.0f*float(d[1]);
         if(!rd2.empty())
-            rd2[data.voxel_index] = 1000.0f*float(d[2]);
+            rd2[data.si] = 1000.0f*float(d[2]);
         if(!rd.empty())
-            rd[data.voxel_index] = 1000.0f*float(d[1]+d[2])/2.0f;
+            rd[data.si] = 1000.0f*float(d[1]+d[2])/2.0f;
 
         if(!ha.empty())
         {
-            ha[data.voxel_index] = float(std::acos(std::sqrt(V[0]*V[0]+V[1]*V[1]))*180.0/3.14159265358979323846);
+            ha[data.si] = float(std::acos(std::sqrt(V[0]*V[0]+V[1]*V[1]))*180.0/3.14159265358979323846);
             tipl::vector<3> center(float(voxel.dim[0])*0.5f,float(voxel.dim[1])*0.5f,float(voxel.dim[2])*0.5f);
             center -= tipl::vector<3>(tipl::pixel_index<3>(data.voxel_index,voxel.dim));
             if((center.cross_product(tipl::vector<3>(0.0f,0.0f,1.0f))*tipl::vector<3>(V) < 0) ^
                     (V[2] < 0.0))
-                ha[data.voxel_index] = -ha[data.voxel_index];
+                ha[data.si] = -ha[data.si];
         }
         if(!txx.empty())
         {
-            txx[data.voxel_index] = float(tensor[0]);
-            txy[data.voxel_index] = float(tensor[1]);
-            txz[data.voxel_index] = float(tensor[2]);
-            tyy[data.voxel_index] = float(tensor[4]);
-            tyz[data.voxel_index] = float(tensor[5]);
-            tzz[data.voxel_index] = float(tensor[8]);
+            txx[data.si] = float(tensor[0]);
+            txy[data.si] = float(tensor[1]);
+            txz[data.si] = float(tensor[2]);
+            tyy[data.si] = float(tensor[4]);
+            tyz[data.si] = float(tensor[5]);
+            tzz[data.si] = float(tensor[8]);
         }
 
     }
@@ -195,18 +248,18 @@ public:
         }
         else
             mat_writer.write("dti_fa",voxel.fib_fa,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("txx",txx,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("txy",txy,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("txz",txz,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("tyy",tyy,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("tyz",tyz,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("tzz",tzz,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("rd1",rd1,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("rd2",rd2,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("ha",ha,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("md",md,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("ad",ad,uint32_t(voxel.dim.plane_size()));
-        mat_writer.write("rd",rd,uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("txx",voxel.expand_masked(txx,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("txy",voxel.expand_masked(txy,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("txz",voxel.expand_masked(txz,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("tyy",voxel.expand_masked(tyy,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("tyz",voxel.expand_masked(tyz,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("tzz",voxel.expand_masked(tzz,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("rd1",voxel.expand_masked(rd1,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("rd2",voxel.expand_masked(rd2,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("ha",voxel.expand_masked(ha,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("md",voxel.expand_masked(md,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("ad",voxel.expand_masked(ad,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("rd",voxel.expand_masked(rd,voxel.dim.size()),uint32_t(voxel.dim.plane_size()));
     }
 };
 
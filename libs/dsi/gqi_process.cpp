@@ -30,10 +30,29 @@ void GQI_Recon::calculate_q_vec_t(Voxel& voxel)
         q_vectors_time[index] *= sigma;
     }
 }
+void GQI_Recon::calculate_kernel_lut(Voxel& voxel)
+{
+    // |q*from| <= |q| because "from" is a unit vector
+    float max_x = 0.0f;
+    for(const auto& q : q_vectors_time)
+        max_x = std::max<float>(max_x,float(q.length()));
+    // linear interpolation error <= h^2/8*max|f''| with h = 1/256:
+    // sinc = int_0^1 cos(rx)dr, |f''| <= 1/3, error < 7e-7
+    // base_function = int_0^1 r^2cos(rx)dr, |f''| <= 1/5, error < 4e-7
+    kernel_lut.resize(size_t(max_x*kernel_lut_scale)+3);
+    for(size_t i = 0;i < kernel_lut.size();++i)
+    {
+        double x = double(i)/double(kernel_lut_scale);
+        kernel_lut[i] = float(voxel.r2_weighted ? base_function(x) : sinc_pi_imp(x));
+    }
+}
 void GQI_Recon::init(Voxel& voxel)
 {
     if(voxel.qsdr)
+    {
         calculate_q_vec_t(voxel);
+        calculate_kernel_lut(voxel);
+    }
     else
         calculate_sinc_ql(voxel);
     dsi_half_sphere = voxel.shell.size() > 4 && voxel.shell[1] - voxel.shell[0] <= 3;
@@ -51,19 +70,20 @@ void GQI_Recon::run(Voxel& voxel, VoxelData& data)
     // add rotation from QSDR or gradient nonlinearity
     if(voxel.qsdr)
     {
-        std::vector<float> sinc_ql_(data.odf.size()*data.space.size());
-        for (unsigned int j = 0,index = 0; j < data.odf.size(); ++j)
+        // the kernel buffer belongs to the thread and is rebuilt only when the jacobian changes
+        auto& sinc_ql_ = data.sinc_ql;
+        if(sinc_ql_.size() != data.odf.size()*data.space.size() || data.sinc_ql_jacobian != data.jacobian)
         {
-            tipl::vector<3,float> from(voxel.ti.vertices[j]);
-            from.rotate(data.jacobian);
-            from.normalize();
-            if(voxel.r2_weighted)
+            sinc_ql_.resize(data.odf.size()*data.space.size());
+            for (unsigned int j = 0,index = 0; j < data.odf.size(); ++j)
+            {
+                tipl::vector<3,float> from(voxel.ti.vertices[j]);
+                from.rotate(data.jacobian);
+                from.normalize();
                 for (unsigned int i = 0; i < data.space.size(); ++i,++index)
-                    sinc_ql_[index] = base_function(q_vectors_time[i]*from);
-            else
-                for (unsigned int i = 0; i < data.space.size(); ++i,++index)
-                    sinc_ql_[index] = sinc_pi_imp(q_vectors_time[i]*from);
-
+                    sinc_ql_[index] = kernel(q_vectors_time[i]*from);
+            }
+            data.sinc_ql_jacobian = data.jacobian;
         }
         tipl::mat::vector_product(&*sinc_ql_.begin(),&*data.space.begin(),&*data.odf.begin(),
                                       tipl::shape<2>(uint32_t(data.odf.size()),uint32_t(data.space.size())));
@@ -41,9 +41,21 @@ public:
     std::vector<tipl::vector<3,float> > q_vectors_time;
     std::vector<float> sinc_ql;
     bool dsi_half_sphere = false;
+private:
+    // sampled sinc_pi_imp or base_function for QSDR, linearly interpolated
+    std::vector<float> kernel_lut;
+    float kernel_lut_scale = 256.0f;
+    float kernel(float x) const
+    {
+        x = std::abs(x)*kernel_lut_scale;
+        size_t i = std::min<size_t>(size_t(x),kernel_lut.size()-2);
+        float w = x-float(i);
+        return kernel_lut[i]+(kernel_lut[i+1]-kernel_lut[i])*w;
+    }
 private:
     void calculate_sinc_ql(Voxel& voxel);
     void calculate_q_vec_t(Voxel& voxel);
+    void calculate_kernel_lut(Voxel& voxel);
 public:
     virtual void init(Voxel& voxel) override;
     virtual void run(Voxel& voxel, VoxelData& data) override;
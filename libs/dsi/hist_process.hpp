@@ -36,12 +36,9 @@ class CalculateGradient : public BaseProcess{
     {
         for(unsigned int i = 0;i < voxel.hist_raw_smoothing;++i)
             tipl::filter::gaussian(hist.I);
-        tipl::image<2> dx,dy;
-        tipl::gradient_2x(hist.I,dx);
-        tipl::gradient_2y(hist.I,dy);
-
-        hist.other_maps[HistData::dx] = std::move(dx);
-        hist.other_maps[HistData::dy] = std::move(dy);
+        // buffers in other_maps are kept by each thread and reused across tiles
+        tipl::gradient_2x(hist.I,hist.other_maps[HistData::dx]);
+        tipl::gradient_2y(hist.I,hist.other_maps[HistData::dy]);
     }
 };
 
@@ -49,9 +46,9 @@ class CalculateStructuralTensor : public BaseProcess{
 
     virtual void run_hist(Voxel& voxel,HistData& hist)
     {
-        tipl::image<2> dxx,dyy,dxy;
-        dxx = std::move(hist.other_maps[HistData::dx]);
-        dyy = std::move(hist.other_maps[HistData::dy]);
+        auto& dxx = hist.other_maps[HistData::dx];
+        auto& dyy = hist.other_maps[HistData::dy];
+        auto& dxy = hist.other_maps[HistData::dxy_full];
         dxy = dxx;
         dxy *= dyy;
         tipl::square(dxx);
@@ -123,20 +120,28 @@ public:
         }
         hist_fa.resize(new_dim);
         hist_dir.resize(new_dim);
+        // skipped tiles are left as zero
+        std::fill(hist_fa.begin(),hist_fa.end(),0.0f);
+        std::fill(hist_dir.begin(),hist_dir.end(),tipl::vector<3>());
     }
     virtual void run_hist(Voxel& voxel,HistData& hist)
     {
-        tipl::image<2> dxx,dyy,dxy;
-        dxx = std::move(hist.other_maps[HistData::dxx]);
-        dyy = std::move(hist.other_maps[HistData::dyy]);
-        dxy = std::move(hist.other_maps[HistData::dxy]);
-
-        tipl::image<3> hist_fa_sub({dxx.width(),dxx.height(),1});
-        tipl::image<3,tipl::vector<3> > hist_dir_sub({dxx.width(),dxx.height(),1});
-
-        for(size_t i = 0;i < dxx.size();++i)
-            if(dxx[i] != 0.0f)
+        const auto& dxx = hist.other_maps[HistData::dxx];
+        const auto& dyy = hist.other_maps[HistData::dyy];
+        const auto& dxy = hist.other_maps[HistData::dxy];
+
+        // tiles do not overlap after margin removal, so results are written in place
+        int x0 = hist.from[0] >> voxel.hist_downsampling;
+        int y0 = hist.from[1] >> voxel.hist_downsampling;
+        int w = std::min<int>(int(dxx.width()),int(hist_fa.width())-x0);
+        int h = std::min<int>(int(dxx.height()),int(hist_fa.height())-y0);
+        for(int y = 0;y < h;++y)
+            for(int x = 0;x < w;++x)
             {
+                size_t i = size_t(y)*dxx.width()+size_t(x);
+                if(dxx[i] == 0.0f)
+                    continue;
+                size_t out = size_t(y0+y)*hist_fa.width()+size_t(x0+x);
                 float dxx_ = dxx[i];
                 float dyy_ = dyy[i];
                 float dxy_ = dxy[i];
@@ -144,14 +149,10 @@ public:
                 float det = dxx_*dyy_-dxy_*dxy_;
                 float deta = std::sqrt(trace*trace-4.0f*det);
                 float nu2 = 0.5f*(trace+deta);
-                hist_fa_sub[i] = std::log(nu2+1.0f);
-                hist_dir_sub[i] = {dxy_,dyy_-nu2,0.0f};
-                hist_dir_sub[i].normalize();
+                hist_fa[out] = std::log(nu2+1.0f);
+                hist_dir[out] = {dxy_,dyy_-nu2,0.0f};
+                hist_dir[out].normalize();
             }
-        auto draw_location = tipl::vector<3>(hist.from[0] >> voxel.hist_downsampling,
-                                             hist.from[1] >> voxel.hist_downsampling,0);
-        tipl::draw(hist_fa_sub,hist_fa,draw_location);
-        tipl::draw(hist_dir_sub,hist_dir,draw_location);
     }
     virtual void end(Voxel&,tipl::io::gz_mat_write& mat_writer)
     {
@@ -351,26 +351,30 @@ size_t sum_dif(const unsigned short* I1,const unsigned short* I2,size_t size)
     return dif;
 }
 
+std::vector<size_t> get_bad_slices(const unsigned short* I,const tipl::shape<3>& dim)
+{
+    std::vector<size_t> result;
+    for(size_t z = 1,pos = dim.plane_size();z + 1 < size_t(dim.depth());++z,pos += dim.plane_size())
+    {
+        auto dif_lower = sum_dif(I + pos-dim.plane_size(),I + pos,dim.plane_size());
+        auto dif_upper = sum_dif(I + pos+dim.plane_size(),I + pos,dim.plane_size());
+        auto dif_upper_lower = sum_dif(I + pos+dim.plane_size(),I + pos-dim.plane_size(),dim.plane_size());
+        if(dif_lower + dif_upper > dif_upper_lower*2)
+            result.push_back(z);
+    }
+    return result;
+}
+
 std::vector<std::pair<size_t,size_t> > ImageModel::get_bad_slices(void)
 {
     std::vector<std::pair<size_t,size_t> > result;
     std::mutex result_mutex;
     tipl::par_for(src_dwi_data.size(),[&](size_t index)
     {        
-        for(size_t z = 1,pos = voxel.dim.plane_size();z + 1 < size_t(voxel.dim.depth());++z,pos += voxel.dim.plane_size())
-        {
-            auto dif_lower = sum_dif(src_dwi_data[index] + pos-voxel.dim.plane_size(),
-                                     src_dwi_data[index] + pos,voxel.dim.plane_size());
-            auto dif_upper = sum_dif(src_dwi_data[index] + pos+voxel.dim.plane_size(),
-                                     src_dwi_data[index] + pos,voxel.dim.plane_size());
-            auto dif_upper_lower = sum_dif(src_dwi_data[index] + pos+voxel.dim.plane_size(),
-                                      src_dwi_data[index] + pos-voxel.dim.plane_size(),voxel.dim.plane_size());
-            if(dif_lower + dif_upper > dif_upper_lower*2)
-            {
-                std::lock_guard<std::mutex> lock(result_mutex);
-                result.push_back(std::make_pair(index,z));
-            }
-        }
+        auto bad_slices = ::get_bad_slices(src_dwi_data[index],voxel.dim);
+        std::lock_guard<std::mutex> lock(result_mutex);
+        for(auto z : bad_slices)
+            result.push_back(std::make_pair(index,z));
     });
     return result;
 }
@@ -388,22 +392,23 @@ float masked_correlation(const unsigned short* I1_ptr,const unsigned short* I2_p
         }
     return float(tipl::correlation(I1.begin(),I1.end(),I2.begin()));
 }
-std::pair<float,float> ImageModel::quality_control_neighboring_dwi_corr(void)
+std::vector<std::pair<size_t,size_t> > get_neighboring_dwi_pairs(const std::vector<float>& bvalues,
+                                                                 const std::vector<tipl::vector<3,float> >& bvectors)
 {
     std::vector<std::pair<size_t,size_t> > corr_pairs;
-    for(size_t i = 0;i < src_bvalues.size();++i)
+    for(size_t i = 0;i < bvalues.size();++i)
     {
-        if(src_bvalues[i] == 0.0f)
+        if(bvalues[i] == 0.0f)
             continue;
         float min_dis = std::numeric_limits<float>::max();
         size_t min_j = 0;
-        for(size_t j = 0;j < src_bvalues.size();++j)
+        for(size_t j = 0;j < bvalues.size();++j)
         {
-            if(i == j || src_bvalues[j] == 0.0f)
+            if(i == j || bvalues[j] == 0.0f)
                 continue;
-            tipl::vector<3> v1(src_bvectors[i]),v2(src_bvectors[j]);
-            v1 *= std::sqrt(src_bvalues[i]);
-            v2 *= std::sqrt(src_bvalues[j]);
+            tipl::vector<3> v1(bvectors[i]),v2(bvectors[j]);
+            v1 *= std::sqrt(bvalues[i]);
+            v2 *= std::sqrt(bvalues[j]);
             if(v1 == v2)
                 continue;
             float dis = std::min<float>(float((v1-v2).length()),
@@ -417,6 +422,11 @@ std::pair<float,float> ImageModel::quality_control_neighboring_dwi_corr(void)
         if(i > min_j)
             corr_pairs.push_back(std::make_pair(i,min_j));
     }
+    return corr_pairs;
+}
+std::pair<float,float> ImageModel::quality_control_neighboring_dwi_corr(void)
+{
+    auto corr_pairs = get_neighboring_dwi_pairs(src_bvalues,src_bvectors);
     std::vector<float> masked_ndc(corr_pairs.size()),ndc(corr_pairs.size());
     tipl::par_for(corr_pairs.size(),[&](size_t index)
     {
@@ -428,29 +438,32 @@ std::pair<float,float> ImageModel::quality_control_neighboring_dwi_corr(void)
     return std::make_pair(tipl::mean(ndc),tipl::mean(masked_ndc));
 }
 
-float ImageModel::dwi_contrast(void)
+void get_dwi_contrast_pairs(const std::vector<float>& bvalues,
+                            const std::vector<tipl::vector<3,float> >& bvectors,
+                            std::vector<size_t>& dwi_self,
+                            std::vector<size_t>& dwi_neighbor,
+                            std::vector<size_t>& dwi_ortho)
 {
-    std::vector<size_t> dwi_self,dwi_neighbor,dwi_ortho;
-    for(size_t i = 0;i < src_bvalues.size();++i)
+    for(size_t i = 0;i < bvalues.size();++i)
     {
-        if(src_bvalues[i] == 0.0f)
+        if(bvalues[i] == 0.0f)
             continue;
         float min_dis1 = std::numeric_limits<float>::max();
         size_t min_j1 = 0;
         float min_dis2 = std::numeric_limits<float>::max();
         size_t min_j2 = 0;
 
-        tipl::vector<3> v1(src_bvectors[i]);
-        v1 *= std::sqrt(src_bvalues[i]);
+        tipl::vector<3> v1(bvectors[i]);
+        v1 *= std::sqrt(bvalues[i]);
         auto v1_length2 = v1.length2();
         auto v1_length = std::sqrt(v1_length2);
 
-        for(size_t j = 0;j < src_bvalues.size();++j)
+        for(size_t j = 0;j < bvalues.size();++j)
         {
-            if(i == j || src_bvalues[j] == 0.0f)
+            if(i == j || bvalues[j] == 0.0f)
                 continue;
-            tipl::vector<3> v2(src_bvectors[j]);
-            v2 *= std::sqrt(src_bvalues[j]);
+            tipl::vector<3> v2(bvectors[j]);
+            v2 *= std::sqrt(bvalues[j]);
             // looking for the neighboring DWI
             if(v1 == v2)
                 continue;
@@ -480,6 +493,12 @@ float ImageModel::dwi_contrast(void)
         dwi_neighbor.push_back(min_j1);
         dwi_ortho.push_back(min_j2);
     }
+}
+
+float ImageModel::dwi_contrast(void)
+{
+    std::vector<size_t> dwi_self,dwi_neighbor,dwi_ortho;
+    get_dwi_contrast_pairs(src_bvalues,src_bvectors,dwi_self,dwi_neighbor,dwi_ortho);
     std::vector<float> ndc(dwi_self.size()),odc(dwi_self.size());
     tipl::par_for(dwi_self.size(),[&](size_t index)
     {
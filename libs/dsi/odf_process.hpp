@@ -1,5 +1,10 @@
 #ifndef ODF_TRANSFORMATION_PROCESS_HPP
 #define ODF_TRANSFORMATION_PROCESS_HPP
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
 #include "basic_process.hpp"
 #include "basic_voxel.hpp"
 
@@ -132,8 +137,133 @@ struct OutputODF : public BaseProcess
 {
 protected:
     std::vector<std::vector<float> > odf_data;
-    std::vector<size_t> odf_index_map;
+protected: // completed blocks spilled to a compressed temporary file
+    unsigned char spill_bits = 0;
+    std::string spill_file_name;
+    std::fstream spill_file;
+    std::mutex spill_mutex;
+    std::vector<size_t> block_voxel_count;
+    std::unique_ptr<std::atomic<size_t>[]> block_filled;
+    std::unique_ptr<std::atomic<float*>[]> block_ptr;
+    std::vector<std::pair<uint64_t,uint64_t> > spill_pos; // offset and compressed size
+    std::vector<float> spill_scale;
+    float* get_block(size_t block)
+    {
+        float* ptr = block_ptr[block];
+        if(ptr)
+            return ptr;
+        std::lock_guard<std::mutex> lock(spill_mutex);
+        if(!block_ptr[block])
+        {
+            odf_data[block].resize(block_voxel_count[block]*half_odf_size);
+            block_ptr[block] = &odf_data[block][0];
+        }
+        return block_ptr[block];
+    }
+    void spill_block(size_t block)
+    {
+        const auto& buf = odf_data[block];
+        float scale = 1.0f;
+        std::vector<char> q;
+        if(spill_bits == 32)
+            q.assign(reinterpret_cast<const char*>(&buf[0]),reinterpret_cast<const char*>(&buf[0]+buf.size()));
+        else
+        {
+            float max_v = 0.0f;
+            for(auto v : buf)
+                max_v = std::max<float>(max_v,std::abs(v));
+            float max_q = (spill_bits == 16 ? 32767.0f : 127.0f);
+            if(max_v > 0.0f)
+                scale = max_v/max_q;
+            std::vector<int> value(buf.size());
+            for(size_t i = 0;i < buf.size();++i)
+                value[i] = int(std::round(buf[i]/scale));
+            // an ODF below the quantization step must not become a zero ODF,
+            // which would be taken as an unmasked voxel when the fib file is read
+            for(size_t i = 0;i < buf.size();i += half_odf_size)
+            {
+                size_t max_pos = i;
+                bool is_zero = true;
+                for(size_t j = i;j < i+half_odf_size;++j)
+                {
+                    if(value[j] != 0)
+                        is_zero = false;
+                    if(std::abs(buf[j]) > std::abs(buf[max_pos]))
+                        max_pos = j;
+                }
+                if(is_zero && buf[max_pos] != 0.0f)
+                    value[max_pos] = (buf[max_pos] > 0.0f ? 1 : -1);
+            }
+            if(spill_bits == 16)
+            {
+                std::vector<short> v(value.begin(),value.end());
+                q.assign(reinterpret_cast<const char*>(&v[0]),reinterpret_cast<const char*>(&v[0]+v.size()));
+            }
+            else
+                q.assign(value.begin(),value.end());
+        }
+        uLongf compressed_size = compressBound(uLong(q.size()));
+        std::vector<Bytef> compressed(compressed_size);
+        if(compress2(&compressed[0],&compressed_size,reinterpret_cast<const Bytef*>(&q[0]),uLong(q.size()),1) != Z_OK)
+            throw std::runtime_error("cannot compress ODF data");
+        std::lock_guard<std::mutex> lock(spill_mutex);
+        spill_file.seekp(0,std::ios::end);
+        spill_pos[block] = std::make_pair(uint64_t(spill_file.tellp()),uint64_t(compressed_size));
+        spill_scale[block] = scale;
+        spill_file.write(reinterpret_cast<const char*>(&compressed[0]),std::streamsize(compressed_size));
+        if(!spill_file)
+            throw std::runtime_error("cannot write ODF data to " + spill_file_name);
+        block_ptr[block] = nullptr;
+        odf_data[block] = std::vector<float>();
+    }
+    bool read_spilled_block(size_t block,std::vector<float>& buf)
+    {
+        std::vector<char> compressed(spill_pos[block].second);
+        spill_file.seekg(std::streamoff(spill_pos[block].first));
+        if(!spill_file.read(&compressed[0],std::streamsize(compressed.size())))
+            return false;
+        buf.resize(block_voxel_count[block]*half_odf_size);
+        std::vector<char> q(buf.size()*(spill_bits/8));
+        uLongf size = uLongf(q.size());
+        if(uncompress(reinterpret_cast<Bytef*>(&q[0]),&size,reinterpret_cast<const Bytef*>(&compressed[0]),uLong(compressed.size())) != Z_OK ||
+           size != q.size())
+            return false;
+        if(spill_bits == 32)
+            std::copy(q.begin(),q.end(),reinterpret_cast<char*>(&buf[0]));
+        else
+        {
+            const short* q16 = reinterpret_cast<const short*>(&q[0]);
+            for(size_t i = 0;i < buf.size();++i)
+                buf[i] = float(spill_bits == 16 ? int(q16[i]) : int(static_cast<signed char>(q[i])))*spill_scale[block];
+        }
+        return true;
+    }
+    void remove_spill_file(void)
+    {
+        if(spill_file.is_open())
+            spill_file.close();
+        if(!spill_file_name.empty())
+        {
+            std::error_code ec;
+            std::filesystem::remove(spill_file_name,ec);
+            spill_file_name.clear();
+        }
+    }
+    bool open_spill_file(void)
+    {
+        std::error_code ec;
+        std::ostringstream out;
+        out << "odf." << std::chrono::steady_clock::now().time_since_epoch().count() << "." << this << ".tmp";
+        spill_file_name = (std::filesystem::temp_directory_path(ec)/out.str()).string();
+        spill_file.open(spill_file_name.c_str(),std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        return spill_file.is_open();
+    }
+    size_t half_odf_size = 0;
 public:
+    virtual ~OutputODF(void)
+    {
+        remove_spill_file();
+    }
     virtual bool needed(Voxel& voxel)
     {
         return voxel.output_odf;
@@ -141,65 +271,111 @@ public:
     virtual void init(Voxel& voxel)
     {
         odf_data.clear();
+        remove_spill_file();
+        half_odf_size = voxel.ti.half_vertices_count;
+        spill_bits = voxel.odf_spill_bits;
         {
             voxel.step_report << "[Step T2b(2)][ODFs]=checked" << std::endl;
-            size_t total_count = 0;
-            odf_index_map.resize(voxel.mask.size());
-            for (size_t index = 0;index < voxel.mask.size();++index)
-                if (voxel.mask[index])
+            // ODFs are stored in the order of masked voxels (si)
+            size_t total_count = voxel.si2vi.size();
+            block_voxel_count.clear();
+            while (1)
+            {
+                if (total_count > odf_block_size)
                 {
-                    odf_index_map[index] = total_count;
-                    ++total_count;
+                    block_voxel_count.push_back(odf_block_size);
+                    total_count -= odf_block_size;
                 }
-            try
-            {
-                std::vector<unsigned int> size_list;
-                while (1)
+                else
                 {
-
-                    if (total_count > odf_block_size)
-                    {
-                        size_list.push_back(odf_block_size);
-                        total_count -= odf_block_size;
-                    }
-                    else
-                    {
-                        size_list.push_back(total_count);
-                        break;
-                    }
+                    block_voxel_count.push_back(total_count);
+                    break;
                 }
-                odf_data.resize(size_list.size());
-                for (unsigned int index = 0;index < odf_data.size();++index)
-                    odf_data[index].resize(size_t(size_list[index])*size_t(voxel.ti.half_vertices_count));
             }
-            catch (...)
+            odf_data.resize(block_voxel_count.size());
+            if(!spill_bits)
             {
-                odf_data.clear();
+                try
+                {
+                    for (unsigned int index = 0;index < odf_data.size();++index)
+                        odf_data[index].resize(block_voxel_count[index]*half_odf_size);
+                    return;
+                }
+                catch (...)
+                {
+                    odf_data.clear();
+                    odf_data.resize(block_voxel_count.size());
+                    tipl::out() << "not enough memory to hold all ODFs, completed blocks will be stored in a temporary file" << std::endl;
+                    spill_bits = 32;
+                }
+            }
+            if(!open_spill_file())
                 throw std::runtime_error("Memory not enough for creating an ODF containing fib file.");
+            tipl::out() << "ODF blocks stored in " << spill_file_name << " at " << int(spill_bits) << "-bit" << std::endl;
+            block_filled.reset(new std::atomic<size_t>[odf_data.size()]);
+            block_ptr.reset(new std::atomic<float*>[odf_data.size()]);
+            for(size_t i = 0;i < odf_data.size();++i)
+            {
+                block_filled[i] = 0;
+                block_ptr[i] = nullptr;
             }
+            spill_pos = std::vector<std::pair<uint64_t,uint64_t> >(odf_data.size());
+            spill_scale = std::vector<float>(odf_data.size(),1.0f);
         }
-
     }
     virtual void run(Voxel& voxel,VoxelData& data)
     {
+        size_t odf_index = data.si;
+        size_t block = odf_index/odf_block_size;
+        if(!spill_bits)
+        {
+            if (data.fa[0] != 0.0f)
+                std::copy(data.odf.begin(),data.odf.end(),
+                          odf_data[block].begin() + (odf_index%odf_block_size)*(voxel.ti.half_vertices_count));
+            return;
+        }
+        // every masked voxel is counted so that the last one completes the block
         if (data.fa[0] != 0.0f)
+            std::copy(data.odf.begin(),data.odf.end(),get_block(block) + (odf_index%odf_block_size)*half_odf_size);
+        if(block_filled[block].fetch_add(1)+1 == block_voxel_count[block])
         {
-            size_t odf_index = odf_index_map[data.voxel_index];
-            std::copy(data.odf.begin(),data.odf.end(),
-                      odf_data[odf_index/odf_block_size].begin() + (odf_index%odf_block_size)*(voxel.ti.half_vertices_count));
+            get_block(block);
+            spill_block(block);
         }
-
     }
     virtual void end(Voxel& voxel,tipl::io::gz_mat_write& mat_writer)
     {
-        tipl::par_for (odf_data.size(),[&](unsigned int index)
-        {
-            tipl::multiply_constant(odf_data[index],voxel.z0);
-        });
         tipl::progress prog("odf",true);
+        if(!spill_bits)
+        {
+            tipl::par_for (odf_data.size(),[&](unsigned int index)
+            {
+                tipl::multiply_constant(odf_data[index],voxel.z0);
+            });
+            for (unsigned int index = 0;prog(index,odf_data.size());++index)
+                mat_writer.write((std::string("odf")+std::to_string(index)).c_str(),odf_data[index],voxel.ti.half_vertices_count);
+            odf_data.clear();
+            return;
+        }
+        std::vector<float> buf;
         for (unsigned int index = 0;prog(index,odf_data.size());++index)
-            mat_writer.write((std::string("odf")+std::to_string(index)).c_str(),odf_data[index],voxel.ti.half_vertices_count);
+        {
+            if(spill_pos[index].second)
+            {
+                if(!read_spilled_block(index,buf))
+                    throw std::runtime_error("cannot read ODF data from " + spill_file_name);
+            }
+            else
+            {
+                // not completed, e.g. canceled
+                buf.swap(odf_data[index]);
+                buf.resize(block_voxel_count[index]*half_odf_size);
+            }
+            tipl::multiply_constant(buf,voxel.z0);
+            mat_writer.write((std::string("odf")+std::to_string(index)).c_str(),buf,voxel.ti.half_vertices_count);
+        }
         odf_data.clear();
+        remove_spill_file();
     }
 };
 
@@ -424,7 +600,7 @@ protected:
     std::vector<std::vector<float> > fa,rdi;
     tipl::shape<3> dim;
 
-    void output_anisotropy(tipl::io::gz_mat_write& mat_writer,
+    void output_anisotropy(const Voxel& voxel,tipl::io::gz_mat_write& mat_writer,
                            const char* name,const std::vector<std::vector<float> >& metrics)
     {
         for (unsigned int index = 0;index < metrics.size();++index)
@@ -433,7 +609,7 @@ protected:
             out << index;
             std::string num = out.str();
             std::string str = name + num;
-            mat_writer.write(str.c_str(),metrics[index],uint32_t(dim.plane_size()));
+            mat_writer.write(str.c_str(),voxel.expand_masked(metrics[index],dim.size()),uint32_t(dim.plane_size()));
         }
     }
 public:
@@ -445,19 +621,20 @@ public:
 
         voxel.z0 = 1.0f;
         dim = voxel.dim;
-        fa = std::vector<std::vector<float> >(voxel.max_fiber_number,std::vector<float>(dim.size()));
+        // metrics are stored by masked voxel index (si) and expanded when written
+        size_t si_count = voxel.si2vi.size();
+        fa = std::vector<std::vector<float> >(voxel.max_fiber_number,std::vector<float>(si_count));
         if(voxel.needs("gfa"))
-            gfa = std::vector<float>(dim.size());
-        iso = std::vector<float>(dim.size());
+            gfa = std::vector<float>(si_count);
+        iso = std::vector<float>(si_count);
+        rdi.clear();
         if(voxel.needs("rdi"))
         {
             float sigma = voxel.param[0]; //optimal 1.24
             for(float L = 0.2f;L <= sigma;L+= 0.2f)
-                rdi.push_back(std::vector<float>(dim.size()));
+                rdi.push_back(std::vector<float>(si_count));
         }
-        findex.resize(voxel.max_fiber_number);
-        for (unsigned int index = 0;index < voxel.max_fiber_number;++index)
-            findex[index].resize(voxel.dim.size());
+        findex = std::vector<std::vector<short> >(voxel.max_fiber_number,std::vector<short>(si_count));
     }
     virtual void run(Voxel& voxel, VoxelData& data)
     {
@@ -522,24 +699,24 @@ public:
             }
         }
 
-        iso[data.voxel_index] = data.min_odf;
+        iso[data.si] = data.min_odf;
 
         if(!gfa.empty())
-            gfa[data.voxel_index] = GeneralizedFA()(data.odf);
+            gfa[data.si] = GeneralizedFA()(data.odf);
 
         for (unsigned int index = 0;index < voxel.max_fiber_number;++index)
-            fa[index][data.voxel_index] = data.fa[index];
+            fa[index][data.si] = data.fa[index];
 
         if(!rdi.empty())
             for (unsigned int index = 0;index < data.rdi.size();++index)
-                rdi[index][data.voxel_index] = data.rdi[index];
+                rdi[index][data.si] = data.rdi[index];
 
         for (unsigned int index = 0;index < voxel.max_fiber_number;++index)
-            findex[index][data.voxel_index] = short(data.dir_index[index]);
+            findex[index][data.si] = short(data.dir_index[index]);
     }
     virtual void end(Voxel& voxel,tipl::io::gz_mat_write& mat_writer)
     {
-        mat_writer.write("gfa",gfa,uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("gfa",voxel.expand_masked(gfa,dim.size()),uint32_t(voxel.dim.plane_size()));
 
         // output normalized qa
         {
@@ -553,17 +730,17 @@ public:
         mat_writer.write("z0",{voxel.z0});
         for (unsigned int index = 0;index < voxel.max_fiber_number;++index)
             tipl::multiply_constant(fa[index],voxel.z0);
-        output_anisotropy(mat_writer,"fa",fa);
+        output_anisotropy(voxel,mat_writer,"fa",fa);
 
         tipl::multiply_constant(iso,voxel.z0);
-        mat_writer.write("iso",iso,uint32_t(voxel.dim.plane_size()));
+        mat_writer.write("iso",voxel.expand_masked(iso,dim.size()),uint32_t(voxel.dim.plane_size()));
 
         if(!rdi.empty())
         {
             for(unsigned int i = 0;i < rdi.size();++i)
                 tipl::multiply_constant(rdi[i],voxel.z0);
             float L = 0.2f;
-            mat_writer.write("rdi",rdi[0],uint32_t(voxel.dim.plane_size()));
+            mat_writer.write("rdi",voxel.expand_masked(rdi[0],dim.size()),uint32_t(voxel.dim.plane_size()));
             if(voxel.shell.size() > 1)
             {
                 for(unsigned int i = 0;i < rdi[0].size();++i)
@@ -575,7 +752,7 @@ public:
                     std::ostringstream out2;
                     out2.precision(2);
                     out2 << "nrdi" << std::setfill('0') << std::setw(2) << int(L*10) << "L";
-                    mat_writer.write(out2.str().c_str(),rdi[i],uint32_t(voxel.dim.plane_size()));
+                    mat_writer.write(out2.str().c_str(),voxel.expand_masked(rdi[i],dim.size()),uint32_t(voxel.dim.plane_size()));
                 }
             }
         }
@@ -587,7 +764,7 @@ public:
             std::string num = out.str();
             std::string index_str = "index";
             index_str += num;
-            mat_writer.write(index_str.c_str(),findex[index],uint32_t(voxel.dim.plane_size()));
+            mat_writer.write(index_str.c_str(),voxel.expand_masked(findex[index],dim.size()),uint32_t(voxel.dim.plane_size()));
         }
     }
 };
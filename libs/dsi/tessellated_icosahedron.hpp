@@ -410,6 +410,7 @@ public:
         vertices.resize(vertices_count);
         faces.resize(faces_count_);
         icosa_cos.clear();
+        lut_width = 0;
         for (unsigned int index = 0;index < vertices_count;++index,odf_buffer += 3)
             vertices[index] = odf_buffer;
         for (unsigned int  index = 0;index < faces_count_;++index,face_buffer += 3)
@@ -515,7 +516,8 @@ public:
             std::copy(faces[i].begin(),faces[i].end(),short_data.begin()+index);
     }
 
-    unsigned short discretize(const tipl::vector<3,float>& v)
+    // brute-force scan: the vertex with the largest |cos|, the first one on ties
+    unsigned short discretize_scan(const tipl::vector<3,float>& v) const
     {
         unsigned short dir_index = 0;
         float max_value = 0.0;
@@ -530,6 +532,108 @@ public:
         }
         return dir_index;
     }
+private:
+    // cube map lookup: each cell of the positive cube faces lists the only vertices that
+    // can be the nearest (in axis angle) to any direction in the cell, in increasing order
+    unsigned int lut_width = 0;
+    std::vector<unsigned int> lut_offset;
+    std::vector<unsigned short> lut_index;
+    static unsigned int lut_cell(const tipl::vector<3,float>& v,unsigned int width)
+    {
+        unsigned int axis = (std::abs(v[0]) >= std::abs(v[1]) && std::abs(v[0]) >= std::abs(v[2])) ? 0 : (std::abs(v[1]) >= std::abs(v[2]) ? 1 : 2);
+        // reflect to the positive face, |cos| is symmetric
+        float m = v[axis];
+        float a = v[(axis+1)%3]/m;
+        float b = v[(axis+2)%3]/m;
+        unsigned int i = std::min<unsigned int>(width-1,uint32_t(std::max<float>(0.0f,(a+1.0f)*0.5f*float(width))));
+        unsigned int j = std::min<unsigned int>(width-1,uint32_t(std::max<float>(0.0f,(b+1.0f)*0.5f*float(width))));
+        return (axis*width+j)*width+i;
+    }
+public:
+    void build_discretize_lut(void)
+    {
+        if(lut_width)
+            return;
+        // cells about half the vertex spacing
+        unsigned int width = std::max<unsigned int>(4,2*uint32_t(std::ceil(std::sqrt(double(half_vertices_count)))));
+        auto axis_angle = [](const tipl::vector<3,double>& p,const tipl::vector<3,double>& q)
+        {
+            return std::acos(std::min<double>(1.0,std::abs(p*q)));
+        };
+        auto face_dir = [width](unsigned int axis,double a,double b)
+        {
+            tipl::vector<3,double> d;
+            d[axis] = 1.0;
+            d[(axis+1)%3] = a*2.0/double(width)-1.0;
+            d[(axis+2)%3] = b*2.0/double(width)-1.0;
+            d.normalize();
+            return d;
+        };
+        std::vector<tipl::vector<3,double> > dirs(half_vertices_count);
+        for(unsigned int k = 0;k < half_vertices_count;++k)
+            dirs[k] = tipl::vector<3,double>(vertices[k][0],vertices[k][1],vertices[k][2]);
+        std::vector<std::vector<unsigned short> > cells(3*width*width);
+        tipl::par_for(cells.size(),[&](size_t cell)
+        {
+            unsigned int axis = uint32_t(cell/(width*width));
+            unsigned int j = uint32_t(cell/width)%width;
+            unsigned int i = uint32_t(cell%width);
+            auto c = face_dir(axis,i+0.5,j+0.5);
+            // the maximum angle to the cell center is at a corner (gnomonic cells are convex)
+            double r = std::max<double>(std::max<double>(axis_angle(c,face_dir(axis,i,j)),axis_angle(c,face_dir(axis,i+1,j))),
+                                        std::max<double>(axis_angle(c,face_dir(axis,i,j+1)),axis_angle(c,face_dir(axis,i+1,j+1))));
+            double nearest = M_PI;
+            for(const auto& each : dirs)
+                nearest = std::min<double>(nearest,axis_angle(c,each));
+            // any vertex nearest to a direction in the cell is within nearest+2r of the center,
+            // the margin covers float rounding in the dot products
+            double bound = nearest+r+r+0.01;
+            for(unsigned int k = 0;k < half_vertices_count;++k)
+                if(axis_angle(c,dirs[k]) <= bound)
+                    cells[cell].push_back(uint16_t(k));
+        });
+        lut_offset.resize(cells.size()+1);
+        lut_index.clear();
+        for(size_t cell = 0;cell < cells.size();++cell)
+        {
+            lut_offset[cell] = uint32_t(lut_index.size());
+            lut_index.insert(lut_index.end(),cells[cell].begin(),cells[cell].end());
+        }
+        lut_offset.back() = uint32_t(lut_index.size());
+        lut_width = width;
+    }
+    // returns the same vertex as discretize_scan. call build_discretize_lut before
+    // discretizing many directions, otherwise it falls back to the scan.
+    unsigned short discretize(const tipl::vector<3,float>& v) const
+    {
+        if(!lut_width || !std::isfinite(v[0]) || !std::isfinite(v[1]) || !std::isfinite(v[2]) ||
+           (v[0] == 0.0f && v[1] == 0.0f && v[2] == 0.0f))
+            return discretize_scan(v);
+        auto cell = lut_cell(v,lut_width);
+        unsigned short dir_index = 0;
+        float max_value = 0.0;
+        for (auto pos = lut_offset[cell]; pos < lut_offset[cell+1]; ++pos)
+        {
+            auto index = lut_index[pos];
+            float value = std::abs(vertices[index]*v);
+            if (value > max_value)
+            {
+                max_value = value;
+                dir_index = index;
+            }
+        }
+        return dir_index;
+    }
+    // discretizes a whole direction field in parallel
+    template<typename dir_container,typename index_type>
+    void discretize(const dir_container& dirs,index_type* dir_index)
+    {
+        build_discretize_lut();
+        tipl::par_for(dirs.size(),[&](size_t i)
+        {
+            dir_index[i] = index_type(discretize(dirs[i]));
+        });
+    }
 };
 
 #endif//TESSELLATED_ICOSAHEDRON_HPP
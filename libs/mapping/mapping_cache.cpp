@@ -0,0 +1,132 @@
+#include <filesystem>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+#include <iomanip>
+#include "mapping_cache.hpp"
+
+std::string mapping_cache::dir = std::getenv("DSI_STUDIO_CACHE") ? std::getenv("DSI_STUDIO_CACHE") : "";
+size_t mapping_cache::max_size_mb = 10240;
+
+mapping_cache& mapping_cache::add(const void* data,size_t size)
+{
+    // two FNV-1a streams with different seeds give a 128-bit key
+    auto ptr = reinterpret_cast<const unsigned char*>(data);
+    for(size_t i = 0;i < size;++i)
+    {
+        h1 = (h1 ^ ptr[i])*1099511628211ULL;
+        h2 = (h2 ^ ptr[i])*14029467366897019727ULL;
+    }
+    // separate consecutive fields
+    h1 = (h1 ^ size)*1099511628211ULL;
+    h2 = (h2 ^ size)*14029467366897019727ULL;
+    return *this;
+}
+mapping_cache& mapping_cache::add_file(const std::string& file_name)
+{
+    std::error_code ec;
+    add(file_name);
+    auto size = std::filesystem::file_size(file_name,ec);
+    add(&size,sizeof(size));
+    auto time = std::filesystem::last_write_time(file_name,ec).time_since_epoch().count();
+    return add(&time,sizeof(time));
+}
+std::string mapping_cache::key(void) const
+{
+    std::ostringstream out;
+    out << std::hex << std::setfill('0') << std::setw(16) << h1 << std::setw(16) << h2;
+    return out.str();
+}
+std::string mapping_cache::file_name(const std::string& category,const std::string& ext) const
+{
+    return dir + "/" + category + "." + key() + ext;
+}
+bool mapping_cache::find(const std::string& category,const std::string& ext,std::string& found_file_name) const
+{
+    if(!enabled())
+        return false;
+    std::error_code ec;
+    found_file_name = file_name(category,ext);
+    if(!std::filesystem::exists(found_file_name,ec))
+        return false;
+    // mark as recently used
+    std::filesystem::last_write_time(found_file_name,std::filesystem::file_time_type::clock::now(),ec);
+    tipl::out() << "found cached " << category << ": " << std::filesystem::path(found_file_name).filename().string() << std::endl;
+    return true;
+}
+bool mapping_cache::store(const std::string& category,const std::string& ext,
+                          std::function<bool(const std::string&)> save) const
+{
+    if(!enabled())
+        return false;
+    std::error_code ec;
+    if(!std::filesystem::exists(dir,ec) && !std::filesystem::create_directories(dir,ec))
+    {
+        tipl::out() << "cannot create cache directory " << dir << std::endl;
+        return false;
+    }
+    // write to a unique temporary file and rename it so that other processes
+    // never see a partially written entry
+    std::ostringstream tmp;
+    tmp << dir << "/" << category << "." << key() << "."
+        << std::hash<std::thread::id>()(std::this_thread::get_id()) << "."
+        << std::chrono::steady_clock::now().time_since_epoch().count() << ".tmp" << ext;
+    if(!save(tmp.str()))
+    {
+        std::filesystem::remove(tmp.str(),ec);
+        tipl::out() << "cannot save " << category << " to the cache directory" << std::endl;
+        return false;
+    }
+    std::filesystem::rename(tmp.str(),file_name(category,ext),ec);
+    if(ec)
+    {
+        std::filesystem::remove(tmp.str(),ec);
+        return false;
+    }
+    tipl::out() << category << " saved to cache: " << std::filesystem::path(file_name(category,ext)).filename().string() << std::endl;
+    evict();
+    return true;
+}
+void mapping_cache::evict(void)
+{
+    if(!enabled())
+        return;
+    std::error_code ec;
+    std::vector<std::pair<std::filesystem::file_time_type,std::filesystem::path> > entries;
+    uintmax_t total_size = 0;
+    auto now = std::filesystem::file_time_type::clock::now();
+    for(const auto& entry : std::filesystem::directory_iterator(dir,ec))
+    {
+        if(!entry.is_regular_file(ec))
+            continue;
+        auto time = entry.last_write_time(ec);
+        // temporary files of other processes are left alone unless they are stale
+        if(entry.path().filename().string().find(".tmp.") != std::string::npos &&
+           now-time < std::chrono::hours(24))
+            continue;
+        auto size = entry.file_size(ec);
+        if(ec)
+            continue;
+        total_size += size;
+        entries.push_back(std::make_pair(time,entry.path()));
+    }
+    uintmax_t max_size = uintmax_t(max_size_mb)*1024*1024;
+    if(total_size <= max_size)
+        return;
+    std::sort(entries.begin(),entries.end());
+    for(const auto& each : entries)
+    {
+        if(total_size <= max_size)
+            break;
+        auto size = std::filesystem::file_size(each.second,ec);
+        if(ec)
+            size = 0;
+        // another process may have removed it already
+        if(std::filesystem::remove(each.second,ec))
+        {
+            tipl::out() << "remove least recently used cache: " << each.second.filename().string() << std::endl;
+            total_size -= size;
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef MAPPING_CACHE_HPP
+#define MAPPING_CACHE_HPP
+#include <string>
+#include <functional>
+#include "TIPL/tipl.hpp"
+
+/*
+ content-addressed cache for normalization results (--cache_dir or DSI_STUDIO_CACHE)
+ entries are keyed by the hash of the input content, template, and parameters, so
+ they can be shared between subjects, processes, and read-only input locations.
+ */
+class mapping_cache{
+public:
+    static std::string dir;         // empty: cache disabled
+    static size_t max_size_mb;      // least recently used entries are removed beyond this size
+    static bool enabled(void){return !dir.empty();}
+private:
+    uint64_t h1 = 14695981039346656037ULL,h2 = 1099511628211ULL;
+public:
+    mapping_cache& add(const void* data,size_t size);
+    mapping_cache& add(const std::string& str){return add(str.data(),str.size());}
+    mapping_cache& add_file(const std::string& file_name); // file name, size, and modification time
+    template<typename container_type>
+    mapping_cache& add_data(const container_type& data)
+    {
+        if(data.empty())
+            return add(std::string("empty"));
+        return add(&*data.begin(),data.size()*sizeof(*data.begin()));
+    }
+    std::string key(void) const;
+public:
+    std::string file_name(const std::string& category,const std::string& ext) const;
+    bool find(const std::string& category,const std::string& ext,std::string& found_file_name) const;
+    bool store(const std::string& category,const std::string& ext,
+               std::function<bool(const std::string&)> save) const;
+    static void evict(void);
+};
+
+#endif//MAPPING_CACHE_HPP
@@ -8,6 +8,7 @@
 #include "tessellated_icosahedron.hpp"
 #include "tract_model.hpp"
 #include "roi.hpp"
+#include "mapping_cache.hpp"
 
 extern std::vector<std::string> fa_template_list;
 bool odf_data::read(tipl::io::gz_mat_read& mat_reader)
@@ -105,19 +106,59 @@ bool odf_data::read(tipl::io::gz_mat_read& mat_reader)
     return true;
 }
 
+// tipl::show_prog is global, so hiding progress has to be counted across loading threads
+struct hide_progress{
+    static std::mutex& mutex(void){static std::mutex m;return m;}
+    static int& count(void){static int c = 0;return c;}
+    static bool& prior(void){static bool p = true;return p;}
+    hide_progress(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        if(count()++ == 0)
+        {
+            prior() = tipl::show_prog;
+            tipl::show_prog = false;
+        }
+    }
+    ~hide_progress(void)
+    {
+        std::lock_guard<std::mutex> lock(mutex());
+        if(--count() == 0)
+            tipl::show_prog = prior();
+    }
+};
+bool item::read_from_own_stream(void)
+{
+    auto& mat = (*mat_reader)[image_index];
+    if(!mat.has_delay_read())
+        return true;
+    // an up-to-date index file allows random access without the shared stream
+    std::string idx_name = file_name + ".idx";
+    if(file_name.empty() || !std::filesystem::exists(idx_name) ||
+       std::filesystem::last_write_time(idx_name) <= std::filesystem::last_write_time(file_name))
+        return false;
+    tipl::io::gz_istream in;
+    in.load_index(idx_name.c_str());
+    in.buffer_all = false;
+    return in.has_access_points() && in.open(file_name.c_str()) && mat.read(in);
+}
 tipl::const_pointer_image<3,float> item::get_image(void)
 {
     if(!image_ready)
     {
-        static std::mutex mat_load;
-        std::lock_guard<std::mutex> lock(mat_load);
+        // each item has its own lock so that different metrics can be loaded concurrently
+        std::lock_guard<std::mutex> lock(*load_mutex);
         if(image_ready)
             return image_data;
         // delay read routine
         unsigned int row,col;
         const float* buf = nullptr;
-        auto prior_show_prog = tipl::show_prog;
-        tipl::show_prog = false;
+        hide_progress hide;
+        static std::mutex shared_stream;
+        std::unique_lock<std::mutex> shared_stream_lock(shared_stream,std::defer_lock);
+        bool own_stream = read_from_own_stream();
+        if(!own_stream)
+            shared_stream_lock.lock();
         if (!mat_reader->read(image_index,row,col,buf))
         {
             tipl::out() << "ERROR: reading " << name << std::endl;
@@ -127,10 +168,10 @@ tipl::const_pointer_image<3,float> item::get_image(void)
         else
         {
             tipl::out() << name << " loaded" << std::endl;
-            mat_reader->in->flush();
+            if(!own_stream)
+                mat_reader->in->flush();
             image_data = tipl::make_image(buf,image_data.shape());
         }
-        tipl::show_prog = prior_show_prog;
         image_ready = true;
         if(max_value == 0.0f)
             get_minmax();
@@ -326,8 +367,15 @@ float fiber_directions::get_track_specific_metrics(size_t space_index,
                          const std::vector<const float*>& metrics,
                          const tipl::vector<3,float>& dir) const
 {
-    if(fa[0][space_index] == 0.0f)
+    int fib_order = get_fib_order(space_index,dir);
+    if(fib_order < 0)
         return 0.0;
+    return metrics[uint32_t(fib_order)][space_index];
+}
+int fiber_directions::get_fib_order(size_t space_index,const tipl::vector<3,float>& dir) const
+{
+    if(fa[0][space_index] == 0.0f)
+        return -1;
     unsigned char fib_order = 0;
     float max_value = std::abs(cos_angle(dir,space_index,0));
     for (unsigned char index = 1;index < uint8_t(fa.size());++index)
@@ -347,7 +395,7 @@ float fiber_directions::get_track_specific_metrics(size_t space_index,
                 fib_order = index;
             }
     }
-    return metrics[fib_order][space_index];
+    return fib_order;
 }
 
 void tracking_data::read(std::shared_ptr<fib_data> fib)
@@ -429,6 +477,7 @@ bool fib_data::load_from_file(const char* file_name)
             dir.odf_faces = ti.faces;
             dir.odf_table = ti.vertices;
             dir.half_odf_size = ti.half_vertices_count;
+            ti.build_discretize_lut();
             tipl::par_for(x.size(),[&](int i)
             {
                 tipl::vector<3> v(-x[i],y[i],z[i]);
@@ -474,6 +523,7 @@ bool fib_data::load_from_file(const char* file_name)
                 dir.odf_faces = ti.faces;
                 dir.odf_table = ti.vertices;
                 dir.half_odf_size = ti.half_vertices_count;
+                ti.build_discretize_lut();
                 tipl::par_for(x.size(),[&](uint32_t j)
                 {
                     tipl::vector<3> v(x[j],y[j],-z[j]);
@@ -721,6 +771,7 @@ bool fib_data::load_from_mat(void)
         if (size_t(mat_reader[index].get_rows())*size_t(mat_reader[index].get_cols()) != dim.size())
             continue;
         view_item.push_back(item(matrix_name,dim,&mat_reader,index));
+        view_item.back().file_name = fib_file_name;
     }
 
     is_human_data = is_human_size(dim,vs); // 1 percentile head size in mm
@@ -1006,6 +1057,30 @@ const tipl::image<3,tipl::vector<3,float> >& fib_data::get_native_position(void)
     return native_position;
 }
 
+void fib_data::prefetch_items(const std::vector<std::string>& names)
+{
+    // the task keeps item pointers, so view_item stays unchanged until it finishes (see wait_prefetch)
+    wait_prefetch();
+    std::vector<item*> item_list;
+    for(const auto& name : names)
+    {
+        size_t index = get_name_index(name);
+        if(index < view_item.size() && !view_item[index].image_ready &&
+           std::find(item_list.begin(),item_list.end(),&view_item[index]) == item_list.end())
+            item_list.push_back(&view_item[index]);
+    }
+    if(item_list.empty())
+        return;
+    prefetch = std::async(std::launch::async,[item_list](void)
+    {
+        tipl::out() << "prefetching " << item_list.size() << " metric(s)" << std::endl;
+        tipl::par_for(item_list.size(),[&](size_t i)
+        {
+            item_list[i]->get_image();
+        },std::min<size_t>(item_list.size(),tipl::max_thread_count));
+    }).share();
+}
+
 size_t fib_data::get_name_index(const std::string& index_name) const
 {
     for(unsigned int index_num = 0;index_num < view_item.size();++index_num)
@@ -1097,31 +1172,26 @@ void fib_data::get_slice(unsigned int view_index,
                unsigned char d_index,unsigned int pos,
                tipl::color_image& show_image)
 {
-    if(view_item[view_index].name == "color")
-    {
-        view_item[view_index].v2c.convert(tipl::volume2slice(view_item[0].get_image(),d_index,pos),show_image);
-
-        if(view_item[view_index].color_map_buf.empty())
-        {
-            view_item[view_index].color_map_buf.resize(dim);
-            std::iota(view_item[view_index].color_map_buf.begin(),
-                      view_item[view_index].color_map_buf.end(),0);
-        }
-        tipl::image<2,unsigned int> buf;
-        tipl::volume2slice(view_item[view_index].color_map_buf, buf, d_index, pos);
-        for (unsigned int index = 0;index < buf.size();++index)
+    bool fiber_color = (view_item[view_index].name == "color");
+    get_slice(fiber_color ? view_item[0].get_image() : view_item[view_index].get_image(),
+              fiber_color,view_item[view_index].v2c,d_index,pos,show_image);
+}
+void fib_data::get_slice(tipl::const_pointer_image<3> I,bool fiber_color,tipl::value_to_color<float> v2c,
+               unsigned char d_index,unsigned int pos,
+               tipl::color_image& show_image) const
+{
+    v2c.convert(tipl::volume2slice(I,d_index,pos),show_image);
+    if(!fiber_color)
+        return;
+    for(int y = 0,index = 0;y < show_image.height();++y)
+        for(int x = 0;x < show_image.width();++x,++index)
         {
-            auto d = dir.get_fib(buf[index],0);
+            auto v = tipl::slice2space<tipl::vector<3> >(d_index,x,y,int(pos));
+            auto d = dir.get_fib(tipl::pixel_index<3>(int(v[0]),int(v[1]),int(v[2]),dim).index(),0);
             show_image[index].r = std::abs(float(show_image[index].r)*d[0]);
             show_image[index].g = std::abs(float(show_image[index].g)*d[1]);
             show_image[index].b = std::abs(float(show_image[index].b)*d[2]);
         }
-    }
-    else
-    {
-        view_item[view_index].v2c.convert(tipl::volume2slice(view_item[view_index].get_image(),d_index,pos),show_image);
-    }
-
 }
 
 void fib_data::get_voxel_info2(int x,int y,int z,std::vector<float>& buf) const
@@ -1325,16 +1395,44 @@ bool fib_data::load_template(void)
         template_to_mni = trans_to_mni;
         return true;
     }
-    tipl::io::gz_nifti read;
-    if(!read.load_from_file(fa_template_list[template_id].c_str()))
     {
-        error_msg = "cannot load ";
-        error_msg += fa_template_list[template_id];
-        return false;
+        // the template images are read once and shared by all subjects (e.g. in batch auto-track)
+        struct template_data{
+            std::string file_name,iso_file_name;
+            tipl::image<3> I,I2;
+            tipl::vector<3> vs;
+            tipl::matrix<4,4> T;
+        };
+        static std::mutex shared_mutex;
+        static std::shared_ptr<const template_data> shared;
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        if(!shared.get() || shared->file_name != fa_template_list[template_id] ||
+                            shared->iso_file_name != iso_template_list[template_id])
+        {
+            auto data = std::make_shared<template_data>();
+            data->file_name = fa_template_list[template_id];
+            data->iso_file_name = iso_template_list[template_id];
+            tipl::io::gz_nifti read;
+            if(!read.load_from_file(data->file_name.c_str()))
+            {
+                error_msg = "cannot load ";
+                error_msg += data->file_name;
+                return false;
+            }
+            read.toLPS(data->I);
+            read.get_voxel_size(data->vs);
+            read.get_image_transformation(data->T);
+            // load iso template if exists
+            tipl::io::gz_nifti read2;
+            if(!data->iso_file_name.empty() && read2.load_from_file(data->iso_file_name.c_str()))
+                read2.toLPS(data->I2);
+            shared = data;
+        }
+        template_I = shared->I;
+        template_I2 = shared->I2;
+        template_vs = shared->vs;
+        template_to_mni = shared->T;
     }
-    read.toLPS(template_I);
-    read.get_voxel_size(template_vs);
-    read.get_image_transformation(template_to_mni);
     float ratio = float(template_I.width()*template_vs[0])/float(dim[0]*vs[0]);
     if(ratio < 0.25f || ratio > 8.0f)
     {
@@ -1359,19 +1457,12 @@ bool fib_data::load_template(void)
         atlas_list[i]->template_to_mni = template_to_mni;
     if(tractography_atlas_roi.get())
         tractography_atlas_roi->template_to_mni = template_to_mni;
+    if(tractography_atlas_roa.get())
+        tractography_atlas_roa->template_to_mni = template_to_mni;
 
-    // load iso template if exists
-    {
-        tipl::io::gz_nifti read2;
-        if(!iso_template_list[template_id].empty() &&
-           read2.load_from_file(iso_template_list[template_id].c_str()))
-        {
-            read2.toLPS(template_I2);
-            for(unsigned int i = 0;i < downsampling;++i)
-                tipl::downsampling(template_I2);
-        }
-
-    }
+    if(!template_I2.empty())
+        for(unsigned int i = 0;i < downsampling;++i)
+            tipl::downsampling(template_I2);
     template_I *= 1.0f/float(tipl::mean(template_I));
     if(!template_I2.empty())
         template_I2 *= 1.0f/float(tipl::mean(template_I2));
@@ -1396,6 +1487,32 @@ void fib_data::temp2sub(std::vector<std::vector<float> >&tracts) const
         }
     });
 }
+// ROI/ROA atlases of the tractography atlas are read once and shared by subjects in the same template space.
+// The key is the file name and template_to_mni: the atlas reads its own label file, and tractography_name_list
+// comes from the .tt.gz.txt next to the same template, so it cannot differ for the same file name.
+static void share_loaded_atlas(std::shared_ptr<atlas>& at)
+{
+    if(!at.get())
+        return;
+    static std::mutex shared_mutex;
+    static std::vector<std::shared_ptr<atlas> > shared;
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    for(auto& each : shared)
+        if(each->filename == at->filename)
+        {
+            if(each->template_to_mni == at->template_to_mni)
+            {
+                at = each;
+                return;
+            }
+            // a different template space, share the copy loaded for it instead
+            if(at->load_from_file())
+                each = at;
+            return;
+        }
+    if(at->load_from_file())
+        shared.push_back(at);
+}
 bool fib_data::load_track_atlas()
 {
     tipl::progress prog("loading tractography atlas");
@@ -1415,50 +1532,72 @@ bool fib_data::load_track_atlas()
     {
         if(!map_to_mni())
             return false;
-        // load the tract to the template space
-        track_atlas = std::make_shared<TractModel>(template_I.shape(),template_vs,template_to_mni);
-        track_atlas->is_mni = true;
-        if(!track_atlas->load_tracts_from_file(tractography_atlas_file_name.c_str(),this,true))
-        {
-            error_msg = "failed to load tractography atlas: ";
-            error_msg += tractography_atlas_file_name;
-            return false;
-        }
-
-        // find left right pairs
-        std::vector<unsigned int> pair(tractography_name_list.size(),uint32_t(tractography_name_list.size()));
-        for(unsigned int i = 0;i < tractography_name_list.size();++i)
-            for(unsigned int j = i + 1;j < tractography_name_list.size();++j)
-                if(tractography_name_list[i].size() == tractography_name_list[j].size() &&
-                   tractography_name_list[i].back() == 'L' && tractography_name_list[j].back() == 'R' &&
-                   tractography_name_list[i].substr(0,tractography_name_list[i].length()-1) ==
-                   tractography_name_list[j].substr(0,tractography_name_list[j].length()-1))
+        // the mirrored atlas in the template space is the same for all subjects using the template
+        {
+            static std::mutex shared_mutex;
+            static std::shared_ptr<const TractModel> shared;
+            static std::string shared_file_name;
+            static tipl::shape<3> shared_dim;
+            static tipl::vector<3> shared_vs;
+            static tipl::matrix<4,4> shared_to_mni;
+            std::lock_guard<std::mutex> lock(shared_mutex);
+            if(!shared.get() || shared_file_name != tractography_atlas_file_name ||
+               shared_dim != template_I.shape() || shared_vs != template_vs || shared_to_mni != template_to_mni)
+            {
+                // load the tract to the template space
+                auto new_atlas = std::make_shared<TractModel>(template_I.shape(),template_vs,template_to_mni);
+                new_atlas->is_mni = true;
+                if(!new_atlas->load_tracts_from_file(tractography_atlas_file_name.c_str(),this,true))
                 {
-                    pair[i] = j;
-                    pair[j] = i;
+                    error_msg = "failed to load tractography atlas: ";
+                    error_msg += tractography_atlas_file_name;
+                    return false;
                 }
 
-        // copy tract from one side to another
-        const auto& tracts = track_atlas->get_tracts();
-        auto& cluster = track_atlas->tract_cluster;
-
-        std::vector<std::vector<float> > new_tracts;
-        std::vector<unsigned int> new_cluster;
-        for(size_t i = 0;i < tracts.size();++i)
-            if(pair[cluster[i]] < tractography_name_list.size())
-            {
-                new_tracts.push_back(tracts[i]);
-                auto& tract = new_tracts.back();
-                // mirror in the x
-                for(size_t pos = 0;pos < tract.size();pos += 3)
-                    tract[pos] = track_atlas->geo.width()-tract[pos];
-                new_cluster.push_back(pair[cluster[i]]);
+                // find left right pairs
+                std::vector<unsigned int> pair(tractography_name_list.size(),uint32_t(tractography_name_list.size()));
+                for(unsigned int i = 0;i < tractography_name_list.size();++i)
+                    for(unsigned int j = i + 1;j < tractography_name_list.size();++j)
+                        if(tractography_name_list[i].size() == tractography_name_list[j].size() &&
+                           tractography_name_list[i].back() == 'L' && tractography_name_list[j].back() == 'R' &&
+                           tractography_name_list[i].substr(0,tractography_name_list[i].length()-1) ==
+                           tractography_name_list[j].substr(0,tractography_name_list[j].length()-1))
+                        {
+                            pair[i] = j;
+                            pair[j] = i;
+                        }
+
+                // copy tract from one side to another
+                const auto& tracts = new_atlas->get_tracts();
+                auto& cluster = new_atlas->tract_cluster;
+
+                std::vector<std::vector<float> > new_tracts;
+                std::vector<unsigned int> new_cluster;
+                for(size_t i = 0;i < tracts.size();++i)
+                    if(pair[cluster[i]] < tractography_name_list.size())
+                    {
+                        new_tracts.push_back(tracts[i]);
+                        auto& tract = new_tracts.back();
+                        // mirror in the x
+                        for(size_t pos = 0;pos < tract.size();pos += 3)
+                            tract[pos] = new_atlas->geo.width()-tract[pos];
+                        new_cluster.push_back(pair[cluster[i]]);
+                    }
+
+                // add adds
+                new_atlas->add_tracts(new_tracts);
+                cluster.insert(cluster.end(),new_cluster.begin(),new_cluster.end());
+
+                shared = new_atlas;
+                shared_file_name = tractography_atlas_file_name;
+                shared_dim = template_I.shape();
+                shared_vs = template_vs;
+                shared_to_mni = template_to_mni;
             }
-
-        // add adds
-        track_atlas->add_tracts(new_tracts);
-        cluster.insert(cluster.end(),new_cluster.begin(),new_cluster.end());
-
+            track_atlas = std::make_shared<TractModel>(*shared);
+            track_atlas->tract_cluster = shared->tract_cluster;
+        }
+        auto& cluster = track_atlas->tract_cluster;
 
         // get distance scaling
         auto& s2t = get_sub2temp_mapping();
@@ -1487,6 +1626,8 @@ bool fib_data::load_track_atlas()
         });
         tract_atlas_min_length.swap(min_length);
         tract_atlas_max_length.swap(max_length);
+        share_loaded_atlas(tractography_atlas_roi);
+        share_loaded_atlas(tractography_atlas_roa);
     }
     return true;
 }
@@ -1661,98 +1802,176 @@ void fib_data::recognize_report(std::shared_ptr<TractModel>& trk,std::string& re
 }
 
 
-bool fib_data::map_to_mni(bool background)
+// registration settings, also part of the mapping cache key
+namespace{
+struct normalization_setting{
+    int method_ver = 202406;
+    tipl::reg::reg_type linear_reg_type = tipl::reg::affine;
+    tipl::reg::cost_type linear_cost_type = tipl::reg::mutual_info;
+    const float* linear_bound = tipl::reg::reg_bound;
+    tipl::reg::cdm_param nonlinear_param;
+};
+}
+std::string fib_data::mapping_file_name(void) const
 {
-    if(!load_template())
-        return false;
-    if(is_mni && template_id == matched_template_id)
-        return true;
-    if(!s2t.empty() && !t2s.empty())
-        return true;
     std::string output_file_name(fib_file_name);
     output_file_name += ".";
     output_file_name += QFileInfo(fa_template_list[template_id].c_str()).baseName().toLower().toStdString();
     output_file_name += ".map.gz";
-
+    return output_file_name;
+}
+bool fib_data::find_mapping(mapping_cache& cache)
+{
+    if(is_mni && template_id == matched_template_id)
+        return true;
+    if(!s2t.empty() && !t2s.empty())
+        return true;
+    normalization_setting setting;
+    std::string output_file_name(mapping_file_name());
     if(std::filesystem::exists(output_file_name))
     {
-        tipl::progress prog("checking existing mapping file");
+        tipl::out() << "checking existing mapping file" << std::endl;
         if(load_mapping(output_file_name.c_str(),false/* not external*/))
+        {
+            // downstream entries (e.g. warped atlases) are keyed by the sidecar file itself
+            mapping_cache sidecar;
+            sidecar.add(&setting.method_ver,sizeof(setting.method_ver)).add_file(output_file_name);
+            mapping_key = sidecar.key();
             return true;
+        }
         tipl::out() << "new mapping file needed: " << error_msg;
         error_msg.clear();
     }
+    if(!mapping_cache::enabled())
+        return false;
 
-    tipl::progress prog_("running normalization");
-    prog = 0;
-    auto lambda = [this,output_file_name]()
-    {
-        dual_reg<3> reg;
-        reg.It = template_I;
-        reg.It2 = template_I2;
-        reg.Itvs = template_vs;
-        reg.ItR = template_to_mni;
+    // the cache key covers everything that determines the registration result
+    bool large_bound = (setting.linear_bound == tipl::reg::large_bound);
+    cache.add(&setting.method_ver,sizeof(setting.method_ver)).add(&dim,sizeof(dim)).add(&vs,sizeof(vs))
+         .add(&trans_to_mni,sizeof(trans_to_mni)).add(dir.fa[0],sizeof(float)*dim.size()).add(dir.index_name[0])
+         .add(&setting.linear_reg_type,sizeof(setting.linear_reg_type)).add(&setting.linear_cost_type,sizeof(setting.linear_cost_type))
+         .add(&large_bound,sizeof(large_bound));
+    // field by field, so that struct padding does not enter the key
+    const auto& param = setting.nonlinear_param;
+    cache.add(&param.resolution,sizeof(param.resolution)).add(&param.speed,sizeof(param.speed))
+         .add(&param.smoothing,sizeof(param.smoothing)).add(&param.iterations,sizeof(param.iterations))
+         .add(&param.min_dimension,sizeof(param.min_dimension));
+    size_t iso_index = get_name_index("iso");
+    if(view_item.size() == iso_index)
+        iso_index = get_name_index("md");
+    if(view_item.size() != iso_index)
+        cache.add_data(view_item[iso_index].get_image());
+    cache.add_file(fa_template_list[template_id]).add_file(iso_template_list[template_id]);
+    if(dir.index_name[0] == "image")
+        cache.add_file(t1w_template_file_name).add_file(t2w_template_file_name);
+    if(has_manual_atlas)
+        cache.add(&manual_template_T,sizeof(manual_template_T));
+
+    std::string cached_file_name;
+    if(cache.find("map",".map.gz",cached_file_name))
+    {
+        if(load_mapping(cached_file_name.c_str()))
+        {
+            mapping_key = cache.key();
+            return true;
+        }
+        tipl::out() << "cannot use cached mapping: " << error_msg;
+        error_msg.clear();
+    }
+    return false;
+}
+bool fib_data::run_normalization(const mapping_cache& cache,bool& terminated,bool show_progress)
+{
+    normalization_setting setting;
+    dual_reg<3> reg;
+    reg.bound = setting.linear_bound;
+    reg.param = setting.nonlinear_param;
+    reg.It = template_I;
+    reg.It2 = template_I2;
+    reg.Itvs = template_vs;
+    reg.ItR = template_to_mni;
 
-        reg.I = tipl::image<3>(dir.fa[0],dim);
-        reg.Ivs = vs;
-        reg.IR = trans_to_mni;
+    reg.I = tipl::image<3>(dir.fa[0],dim);
+    reg.Ivs = vs;
+    reg.IR = trans_to_mni;
 
-        // not FIB file, use t1w as template
-        if(dir.index_name[0] == "image")
+    // not FIB file, use t1w as template
+    if(dir.index_name[0] == "image")
+    {
+        if(!reg.load_template2(t1w_template_file_name.c_str()))
         {
-            if(!reg.load_template2(t1w_template_file_name.c_str()))
-            {
-                prog = 6;
-                error_msg = "cannot perform normalization";
-                tipl::prog_aborted = true;
-                return;
-            }
-            reg.It2.swap(reg.It);
-            tipl::out() << "using structure image for normalization" << std::endl;
+            error_msg = "cannot perform normalization";
+            return false;
         }
+        reg.It2.swap(reg.It);
+        tipl::out() << "using structure image for normalization" << std::endl;
+    }
 
-        {
-            size_t iso_index = get_name_index("iso");
-            if(view_item.size() == iso_index)
-                iso_index = get_name_index("md");
-            if(view_item.size() != iso_index)
-                reg.I2 = view_item[iso_index].get_image();
-        }
+    {
+        size_t iso_index = get_name_index("iso");
+        if(view_item.size() == iso_index)
+            iso_index = get_name_index("md");
+        if(view_item.size() != iso_index)
+            reg.I2 = view_item[iso_index].get_image();
+    }
 
-        prog = 1;
-        if(has_manual_atlas)
-            reg.arg = manual_template_T;
+    prog = 1;
+    if(has_manual_atlas)
+        reg.arg = manual_template_T;
+    else
+    {
+        if(show_progress)
+            reg.linear_reg(setting.linear_reg_type,setting.linear_cost_type,terminated);
         else
-            reg.linear_reg(tipl::reg::affine,tipl::reg::mutual_info);
+            reg.linear_reg<no_progress>(setting.linear_reg_type,setting.linear_cost_type,terminated);
+    }
 
-        if(tipl::prog_aborted)
-        {
-            prog = 6;
-            return;
-        }
-        prog = 3;
-        if(dir.index_name[0] == "image")
-        {
-            tipl::out() << "matching t1w t2w contrast" << std::endl;
-            if(reg.load_template2(t2w_template_file_name.c_str()))
-                reg.matching_contrast();
-        }
-        prog = 4;
-        if(reg.nonlinear_reg(tipl::prog_aborted) < 0.3f)
-        {
-            error_msg = "cannot perform normalization";
-            tipl::prog_aborted = true;
-        }
-        if(tipl::prog_aborted)
-        {
-            prog = 6;
-            return;
-        }
-        prog = 5;
-        if(!reg.save_warping(output_file_name.c_str()))
-            tipl::out() << reg.error_msg;
-        s2t.swap(reg.from2to);
-        t2s.swap(reg.to2from);
+    if(terminated)
+    {
+        error_msg = "aborted.";
+        return false;
+    }
+    prog = 3;
+    if(dir.index_name[0] == "image")
+    {
+        tipl::out() << "matching t1w t2w contrast" << std::endl;
+        if(reg.load_template2(t2w_template_file_name.c_str()))
+            reg.matching_contrast();
+    }
+    prog = 4;
+    if((show_progress ? reg.nonlinear_reg(terminated) : reg.nonlinear_reg<no_progress>(terminated)) < 0.3f)
+    {
+        error_msg = terminated ? "aborted." : "cannot perform normalization";
+        return false;
+    }
+    prog = 5;
+    // the sidecar file is always attempted; the input folder may be read-only
+    std::string output_file_name(mapping_file_name());
+    if(!reg.save_warping(output_file_name.c_str()))
+        tipl::out() << reg.error_msg;
+    if(mapping_cache::enabled())
+    {
+        cache.store("map",".map.gz",[&](const std::string& file_name){return reg.save_warping(file_name.c_str());});
+        mapping_key = cache.key();
+    }
+    s2t.swap(reg.from2to);
+    t2s.swap(reg.to2from);
+    return true;
+}
+bool fib_data::map_to_mni(bool background)
+{
+    if(!load_template())
+        return false;
+    mapping_cache cache;
+    if(find_mapping(cache))
+        return true;
+
+    tipl::progress prog_("running normalization");
+    prog = 0;
+    bool result = false;
+    auto lambda = [&]()
+    {
+        result = run_normalization(cache,tipl::prog_aborted,true);
         prog = 6;
     };
 
@@ -1767,15 +1986,27 @@ bool fib_data::map_to_mni(bool background)
             tipl::prog_aborted = true;
         }
         t.join();
-        return !prog_.aborted();
+        return result && !prog_.aborted();
     }
 
     tipl::out() << "Subject normalization to MNI space." << std::endl;
     lambda();
-    return !prog_.aborted();
+    return result;
+}
+bool fib_data::map_to_mni_in_worker(bool& terminated)
+{
+    if(!load_template())
+        return false;
+    mapping_cache cache;
+    if(find_mapping(cache))
+        return true;
+    tipl::out() << "Subject normalization to MNI space." << std::endl;
+    prog = 0;
+    return run_normalization(cache,terminated,false);
 }
 bool fib_data::load_mapping(const char* file_name,bool external)
 {
+    mapping_key.clear();
     if(tipl::ends_with(file_name,".map.gz"))
     {
         tipl::io::gz_mat_read in;
@@ -2018,6 +2249,33 @@ bool fib_data::get_atlas_all_roi(std::shared_ptr<atlas> at,
         return false;
     }
 
+    // warped atlas regions are cached with the mapping they were derived from
+    mapping_cache cache;
+    if(!mapping_key.empty() && mapping_cache::enabled())
+    {
+        cache.add(mapping_key).add_file(at->filename).add(&new_geo,sizeof(new_geo)).add(&to_diffusion_space,sizeof(to_diffusion_space));
+        std::string cached_file_name;
+        tipl::io::gz_mat_read in;
+        if(cache.find("atlas",".mat.gz",cached_file_name) &&
+           in.load_from_file(cached_file_name.c_str()) &&
+           in.read<std::string>("atlas") == at->filename)
+        {
+            labels = at->get_list();
+            points.clear();
+            points.resize(labels.size());
+            for(size_t i = 0;i < points.size();++i)
+            {
+                unsigned int row,col;
+                const short* ptr = nullptr;
+                if(in.read(("region"+std::to_string(i)).c_str(),row,col,ptr) && row == 3)
+                {
+                    points[i].resize(col);
+                    std::copy(ptr,ptr+size_t(col)*3,&points[i][0][0]);
+                }
+            }
+            return true;
+        }
+    }
 
     std::vector<std::vector<std::vector<tipl::vector<3,short> > > > region_voxels(std::thread::hardware_concurrency());
     for(auto& region : region_voxels)
@@ -2075,6 +2333,18 @@ bool fib_data::get_atlas_all_roi(std::shared_ptr<atlas> at,
         std::sort(region_voxels[0][i].begin(),region_voxels[0][i].end());
     });
     region_voxels[0].swap(points);
+    if(!mapping_key.empty())
+        cache.store("atlas",".mat.gz",[&](const std::string& file_name)
+        {
+            tipl::io::gz_mat_write out(file_name.c_str());
+            if(!out)
+                return false;
+            out.write("atlas",at->filename);
+            for(size_t i = 0;i < points.size();++i)
+                if(!points[i].empty())
+                    out.write(("region"+std::to_string(i)).c_str(),&points[i][0][0],3,uint32_t(points[i].size()));
+            return bool(out);
+        });
     return true;
 }
 
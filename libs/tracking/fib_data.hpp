@@ -3,9 +3,13 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <future>
+#include <atomic>
 #include "connectometry_db.hpp"
 #include "atlas.hpp"
 
+class mapping_cache;
+
 struct odf_data{
 private:
     tipl::image<3,const float*> odf_map;
@@ -51,6 +55,7 @@ public:
     float cos_angle(const tipl::vector<3>& cur_dir,size_t space_index,unsigned char fib_order) const;
     float get_track_specific_metrics(size_t space_index,const std::vector<const float*>& index,
                              const tipl::vector<3,float>& dir) const;
+    int get_fib_order(size_t space_index,const tipl::vector<3,float>& dir) const; // -1: no fiber
 };
 
 class fib_data;
@@ -152,6 +157,16 @@ public:
 
 
 
+// image_ready is checked without the load lock while a prefetch may be setting it
+struct ready_flag{
+    std::atomic<bool> value;
+    ready_flag(bool value_ = true):value(value_){}
+    ready_flag(const ready_flag& rhs):value(rhs.value.load()){}
+    ready_flag& operator=(const ready_flag& rhs){value = rhs.value.load();return *this;}
+    ready_flag& operator=(bool value_){value = value_;return *this;}
+    operator bool(void) const{return value;}
+};
+
 struct item
 {
 private:
@@ -159,6 +174,8 @@ private:
     tipl::image<3> dummy;
     tipl::io::gz_mat_read* mat_reader = nullptr;
     unsigned int image_index = 0;
+    std::shared_ptr<std::mutex> load_mutex = std::make_shared<std::mutex>();
+    bool read_from_own_stream(void);
 public:
     template<typename value_type>
     item(const std::string& name_,const value_type* pointer,const tipl::shape<3>& dim_):
@@ -187,7 +204,8 @@ public:
     void set_image(tipl::const_pointer_image<3> new_image){image_data = new_image;}
 public:
     std::string name;
-    bool image_ready = true;
+    std::string file_name; // for reading delayed data with an independent stream
+    ready_flag image_ready = true;
     bool registering = false;
     tipl::matrix<4,4> T,iT;// T: image->diffusion iT: diffusion->image
 
@@ -199,7 +217,6 @@ public:
     float contrast_min = 0.0f;
     unsigned int max_color = 0x00FFFFFF;
     unsigned int min_color = 0;
-    tipl::image<3,unsigned int> color_map_buf;
 
     // for other slice in QSDR, allow for loading t1w-based ROIs in QSDR fib
     tipl::shape<3> native_geo;
@@ -265,9 +282,19 @@ public:
     mutable std::vector<item> view_item;
 public:
     std::shared_ptr<fib_data> high_reso;
+public:
+    // the prefetch holds pointers into view_item: call wait_prefetch() before adding or removing items
+    std::shared_future<void> prefetch;
+    void prefetch_items(const std::vector<std::string>& names);
+    void wait_prefetch(void) const
+    {
+        if(prefetch.valid())
+            prefetch.wait();
+    }
 public:
     int prog;
     tipl::image<3,tipl::vector<3,float> > s2t,t2s;
+    std::string mapping_key; // content hash of the normalization inputs, used by mapping_cache
 private:
     mutable tipl::image<3,tipl::vector<3,float> > native_position;
 public:
@@ -311,8 +338,15 @@ public:
     bool load_track_atlas(void);
     std::vector<size_t> get_track_ids(const std::string& tract_name);
     std::pair<float,float> get_track_minmax_length(const std::string& tract_name);
+private:
+    std::string mapping_file_name(void) const;
+    bool find_mapping(mapping_cache& cache);
+    bool run_normalization(const mapping_cache& cache,bool& terminated,bool show_progress);
 public:
     bool map_to_mni(bool background = true);
+    // for threads preparing a subject ahead of time: the registration creates no tipl::progress,
+    // and failures are returned through error_msg instead of the global abort flag
+    bool map_to_mni_in_worker(bool& terminated);
     void temp2sub(std::vector<std::vector<float> >&tracts) const;
     void temp2sub(tipl::vector<3>& pos) const;
     void sub2temp(tipl::vector<3>& pos);
@@ -370,6 +404,10 @@ public:
     }
     fib_data(tipl::shape<3> dim_,tipl::vector<3> vs_);
     fib_data(tipl::shape<3> dim_,tipl::vector<3> vs_,const tipl::matrix<4,4>& trans_to_mni_);
+    ~fib_data(void)
+    {
+        wait_prefetch();
+    }
 public:
     bool load_from_file(const char* file_name);
     bool load_from_mat(void);
@@ -386,6 +424,10 @@ public:
     void get_slice(unsigned int view_index,
                    unsigned char d_index,unsigned int pos,
                    tipl::color_image& show_image);
+    // reads no view_item state, for drawing outside the UI thread
+    void get_slice(tipl::const_pointer_image<3> I,bool fiber_color,tipl::value_to_color<float> v2c,
+                   unsigned char d_index,unsigned int pos,
+                   tipl::color_image& show_image) const;
     void get_voxel_info2(int x,int y,int z,std::vector<float>& buf) const;
     void get_voxel_information(int x,int y,int z,std::vector<float>& buf) const;
     auto get_iso(void) const
@@ -7,6 +7,7 @@
 #include "basic_process.hpp"
 #include "roi.hpp"
 #include "fib_data.hpp"
+#include "tract_resample.hpp"
 
 
 struct TrackingParam
@@ -186,6 +187,7 @@ private:
     std::shared_ptr<RoiMgr> roi_mgr;
 	std::vector<float> track_buffer;
 	mutable std::vector<float> reverse_buffer;
+    tract_resample_buffer smooth_buffer;
     unsigned int buffer_front_pos;
     unsigned int buffer_back_pos;
     unsigned char init_fib_index;
@@ -298,25 +300,8 @@ public:
 
                 // smooth trajectories
                 {
-                    std::vector<float> smoothed(track_buffer.size());
-                    float w[5] = {1.0,2.0,4.0,2.0,1.0};
-                    int dis[5] = {-6, -3, 0, 3, 6};
-                    for(size_t index = buffer_front_pos;index < buffer_back_pos;++index)
-                    {
-                        float sum_w = 0.0;
-                        float sum = 0.0;
-                        for(int i = 0;i < 5;++i)
-                        {
-                            int cur_index = int(index) + dis[i];
-                            if(cur_index < int(buffer_front_pos) || cur_index >= int(buffer_back_pos))
-                                continue;
-                            sum += w[i]*track_buffer[uint32_t(cur_index)];
-                            sum_w += w[i];
-                        }
-                        if(sum_w != 0.0f)
-                            smoothed[index] = sum/sum_w;
-                    }
-                    smoothed.swap(track_buffer);
+                    static const std::vector<float> kernel = {4.0f,2.0f,1.0f};
+                    smooth_tract(&track_buffer[buffer_front_pos],(buffer_back_pos-buffer_front_pos)/3,kernel,smooth_buffer);
                 }
                 break;
             default:
@@ -50,6 +50,13 @@ void ThreadData::run_thread(unsigned int thread_id,unsigned int thread_count)
                 param.termination_count = std::max<uint32_t>(1,roi_mgr->track_voxel_ratio*roi_mgr->seeds.size());
                 param.max_seed_count = param.termination_count*5000; //yield rate easy:1/100 hard:1/5000
             }
+            if(adaptive_seeding)
+            {
+                seed_attempt = std::vector<uint32_t>(roi_mgr->seeds.size());
+                seed_yield = std::vector<uint32_t>(roi_mgr->seeds.size());
+                seed_pruned = std::vector<unsigned char>(roi_mgr->seeds.size());
+            }
+            total_seed_attempt = total_seed_yield = productive_seed_attempt = pruned_voxel_count = skipped_seed_count = 0;
         }
         ready_to_track = true;
     }
@@ -71,6 +78,7 @@ void ThreadData::run_thread(unsigned int thread_id,unsigned int thread_count)
         param.termination_count-(param.termination_count/thread_count)*(thread_count-1):
         param.termination_count/thread_count);
     unsigned int max_seed_per_thread = param.max_seed_count/thread_count;
+    uint32_t seed_index = 0;
     if(!roi_mgr->seeds.empty())
     try{
         while(!joining &&
@@ -102,7 +110,16 @@ void ThreadData::run_thread(unsigned int thread_id,unsigned int thread_count)
                     method->current_min_steps3 = 3*uint32_t(std::round(param.min_length/step_size_in_mm));
                 }
 
-                uint32_t seed_index = std::min<uint32_t>(uint32_t(roi_mgr->seeds.size()-1),uint32_t(rand_gen(seed)*float(roi_mgr->seeds.size())));
+                do{
+                    seed_index = std::min<uint32_t>(uint32_t(roi_mgr->seeds.size()-1),uint32_t(rand_gen(seed)*float(roi_mgr->seeds.size())));
+                }while(adaptive_seeding && is_unproductive_seed(seed_index));
+                if(adaptive_seeding)
+                {
+                    ++seed_attempt[seed_index];
+                    ++total_seed_attempt;
+                    if(seed_yield[seed_index])
+                        ++productive_seed_attempt;
+                }
                 tipl::vector<3> pos = roi_mgr->seeds[seed_index];
                 pos[0] += subvoxel_gen(seed);
                 pos[1] += subvoxel_gen(seed);
@@ -122,6 +139,14 @@ void ThreadData::run_thread(unsigned int thread_id,unsigned int thread_count)
             const float* end = result+point_count+point_count+point_count;
 
             ++tract_count[thread_id];
+            if(adaptive_seeding)
+            {
+                std::lock_guard<std::mutex> lock(lock_seed_function);
+                // the first tract moves the voxel's attempts into the productive count
+                if(!seed_yield[seed_index]++)
+                    productive_seed_attempt += seed_attempt[seed_index];
+                ++total_seed_yield;
+            }
             if(buffer_switch)
                 track_buffer_front[thread_id].push_back(std::vector<float>(result,end));
             else
@@ -136,6 +161,45 @@ void ThreadData::run_thread(unsigned int thread_id,unsigned int thread_count)
     end_time = std::chrono::high_resolution_clock::now();
 }
 
+bool ThreadData::is_unproductive_seed(uint32_t seed_index)
+{
+    if(seed_pruned[seed_index])
+    {
+        ++skipped_seed_count;
+        return true;
+    }
+    // prune a voxel that has yielded nothing after enough attempts to expect 5 tracts at the rate of
+    // the productive voxels (chance of pruning a voxel as good as them < e^-5). in a low-yield bundle the
+    // tracts come from a small part of the seed region, so this rate is much higher than the bundle
+    // average. if the yield is uniformly low, nothing is pruned because a failing voxel cannot be told
+    // from an unlucky one. a voxel with yield is never pruned, so redrawing terminates
+    if(seed_yield[seed_index] || total_seed_yield < 20 ||
+       uint64_t(seed_attempt[seed_index])*total_seed_yield < 5*uint64_t(productive_seed_attempt))
+        return false;
+    seed_pruned[seed_index] = 1;
+    ++pruned_voxel_count;
+    ++skipped_seed_count;
+    return true;
+}
+std::string ThreadData::get_seed_yield_report(void) const
+{
+    size_t productive_voxel_count = 0,tried_voxel_count = 0;
+    for(size_t i = 0;i < seed_attempt.size();++i)
+    {
+        if(seed_attempt[i])
+            ++tried_voxel_count;
+        if(seed_yield[i])
+            ++productive_voxel_count;
+    }
+    std::ostringstream out;
+    out << "seed voxels: " << seed_attempt.size()
+        << " tried: " << tried_voxel_count
+        << " productive: " << productive_voxel_count
+        << " pruned: " << pruned_voxel_count
+        << " skipped seeds: " << skipped_seed_count;
+    return out.str();
+}
+
 bool ThreadData::fetchTracks(TractModel* handle)
 {
     bool has_track = false;
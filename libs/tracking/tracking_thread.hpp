@@ -54,6 +54,14 @@ public:
     {
         return running.empty() ? true : std::find(running.begin(),running.end(),1) == running.end();
     }
+public: // seed yield statistics, guarded by lock_seed_function and only collected with adaptive_seeding
+    bool adaptive_seeding = false; // skip seed voxels that keep failing, not reproducible across runs
+    std::vector<uint32_t> seed_attempt,seed_yield;
+    std::vector<unsigned char> seed_pruned;
+    size_t total_seed_attempt = 0,total_seed_yield = 0,pruned_voxel_count = 0,skipped_seed_count = 0;
+    size_t productive_seed_attempt = 0; // attempts at voxels that have yielded a tract
+    bool is_unproductive_seed(uint32_t seed_index);
+    std::string get_seed_yield_report(void) const;
 public:
     bool buffer_switch = true;
     std::vector<std::vector<std::vector<float> > > track_buffer_back,track_buffer_front;
@@ -4,6 +4,7 @@
 #include <map>
 #include "zlib.h"
 #include "TIPL/tipl.hpp"
+#include "tract_resample.hpp"
 
 struct Cluster
 {
@@ -48,17 +49,21 @@ public:
 public:
     virtual void add_tracts(const std::vector<std::vector<float> >& tracks)
     {
+        tract_resample_buffer buf;
+        std::vector<float> points;
         for(int i = 0;i < tracks.size();++i)
             if(!tracks[i].empty())
             {
-                const float* points = &tracks[i][0];
                 unsigned int count = tracks[i].size();
+                // both ends and the mid point by arc length
+                points = tracks[i];
+                resample_tract_to(points,3,buf);
                 std::vector<double> feature(10);
-                std::copy(points,points+3,feature.begin());
-                std::copy(points+count-3,points+count,feature.begin()+3);
+                std::copy(points.begin(),points.begin()+3,feature.begin());
+                std::copy(points.begin()+6,points.begin()+9,feature.begin()+3);
+                std::copy(points.begin()+3,points.begin()+6,feature.begin()+6);
                 count >>= 1;
                 count -= count%3;
-                std::copy(points+count-3,points+count,feature.begin()+6);
                 feature.back() = count;
                 features.push_back(feature);
             }
@@ -0,0 +1,215 @@
+#include <algorithm>
+#include "tract_density.hpp"
+
+tract_density::tract_density(const tipl::shape<3>& dim_,const tipl::matrix<4,4>& trans_,const tipl::vector<3>& vs_,unsigned int maps_):
+    dim(dim_),trans(trans_),vs(vs_),maps(maps_)
+{
+    if(maps & length_map)
+        maps |= count_map;
+    tile_count = tipl::max_thread_count*4;
+    tile_size = dim.size()/tile_count+1;
+    hits.resize(tipl::max_thread_count);
+    for(auto& each : hits)
+        each.resize(tile_count);
+    if(maps & count_map)
+        count.resize(dim);
+    if(maps & end_map)
+        end_count.resize(dim);
+    if(maps & (dir_map | end_dir_map))
+        dir.resize(dim);
+    if(maps & length_map)
+        length.resize(dim);
+}
+
+bool tract_density::get_index(tipl::vector<3> p,size_t& index) const
+{
+    p.round();
+    tipl::vector<3,int> ipos(p);
+    if(!dim.is_valid(ipos))
+        return false;
+    index = tipl::voxel2index(ipos.begin(),dim);
+    return true;
+}
+
+void tract_density::add(const std::vector<float>& tract,std::vector<tile_hits>& out,std::vector<size_t>& voxels) const
+{
+    size_t n = tract.size()/3;
+    if(!n)
+        return;
+    std::vector<tipl::vector<3> > points(n);
+    for(size_t j = 0;j < n;++j)
+    {
+        points[j] = tipl::vector<3>(&tract[j*3]);
+        points[j].to(trans);
+    }
+    size_t index = 0;
+    // segments longer than a voxel (e.g. supersampled grid) are sampled every half voxel
+    auto for_each_sample = [&](size_t j,auto&& fun)
+    {
+        if(j)
+        {
+            auto d = points[j]-points[j-1];
+            float l = float(d.length());
+            if(l > 1.0f)
+            {
+                unsigned int k = uint32_t(std::ceil(2.0f*l));
+                for(unsigned int s = 1;s < k;++s)
+                    fun(points[j-1]+d*(float(s)/float(k)));
+            }
+        }
+        fun(points[j]);
+    };
+    if(maps & count_map)
+    {
+        voxels.clear();
+        for(size_t j = 0;j < n;++j)
+            for_each_sample(j,[&](const tipl::vector<3>& p)
+            {
+                if(get_index(p,index))
+                    voxels.push_back(index);
+            });
+        std::sort(voxels.begin(),voxels.end());
+        voxels.erase(std::unique(voxels.begin(),voxels.end()),voxels.end());
+        float tract_length = 0.0f;
+        if(maps & length_map)
+            for(size_t j = 3;j < tract.size();j += 3)
+                tract_length += float(tipl::vector<3>(vs[0]*(tract[j]-tract[j-3]),
+                                                      vs[1]*(tract[j+1]-tract[j-2]),
+                                                      vs[2]*(tract[j+2]-tract[j-1])).length());
+        for(auto v : voxels)
+        {
+            auto& tile = out[v/tile_size];
+            tile.count.push_back(v);
+            if(maps & length_map)
+                tile.length.push_back(std::make_pair(v,tract_length));
+        }
+    }
+    if(maps & end_map)
+    {
+        size_t i1 = 0,i2 = 0;
+        bool has1 = get_index(points.front(),i1);
+        bool has2 = get_index(points.back(),i2);
+        if(has1)
+            out[i1/tile_size].end.push_back(i1);
+        if(has2 && !(has1 && i1 == i2))
+            out[i2/tile_size].end.push_back(i2);
+    }
+    if(maps & (dir_map | end_dir_map))
+    {
+        auto add_dir = [&](size_t j)
+        {
+            tipl::vector<3> d(points[j-1]-points[j]);
+            if(d.length() == 0.0)
+                return;
+            d.normalize();
+            d[0] = std::fabs(d[0]);
+            d[1] = std::fabs(d[1]);
+            d[2] = std::fabs(d[2]);
+            for_each_sample(j,[&](const tipl::vector<3>& p)
+            {
+                if(get_index(p,index))
+                    out[index/tile_size].dir.push_back(std::make_pair(index,d));
+            });
+        };
+        if(maps & end_dir_map)
+        {
+            // the first and last segments, as in the end point TDI
+            if(n > 1)
+                add_dir(1);
+            if(n > 2)
+                add_dir(n-1);
+        }
+        else
+            for(size_t j = 1;j < n;++j)
+                add_dir(j);
+    }
+}
+
+void tract_density::reduce(void)
+{
+    tipl::par_for(tile_count,[&](size_t t)
+    {
+        for(auto& thread_hits : hits)
+        {
+            auto& h = thread_hits[t];
+            for(auto i : h.count)
+                ++count[i];
+            for(auto i : h.end)
+                ++end_count[i];
+            for(const auto& each : h.dir)
+                dir[each.first] += each.second;
+            for(const auto& each : h.length)
+                length[each.first] += each.second;
+            h.count.clear();
+            h.end.clear();
+            h.dir.clear();
+            h.length.clear();
+        }
+    });
+}
+
+void tract_density::add(const std::vector<std::vector<float> >& tracts)
+{
+    // reduce every batch to bound the size of the hit buffers
+    const size_t batch_size = 16384;
+    std::vector<std::vector<size_t> > voxels(hits.size());
+    for(size_t from = 0;from < tracts.size();from += batch_size)
+    {
+        size_t size = std::min<size_t>(batch_size,tracts.size()-from);
+        tipl::par_for<tipl::sequential_with_id>(size,[&](size_t i,size_t thread)
+        {
+            add(tracts[from+i],hits[thread],voxels[thread]);
+        });
+        reduce();
+    }
+}
+
+void tract_density::add(const std::vector<tipl::vector<3,short> >& voxels,map_type map)
+{
+    if(!(maps & map) || (map != count_map && map != end_map))
+        return;
+    tipl::par_for<tipl::sequential_with_id>(voxels.size(),[&](size_t i,size_t thread)
+    {
+        if(!dim.is_valid(voxels[i]))
+            return;
+        size_t index = tipl::pixel_index<3>(voxels[i][0],voxels[i][1],voxels[i][2],dim).index();
+        auto& tile = hits[thread][index/tile_size];
+        if(map == count_map)
+            tile.count.push_back(index);
+        else
+            tile.end.push_back(index);
+    });
+    reduce();
+}
+
+void tract_density::get_rgb(tipl::image<3,tipl::rgb>& I) const
+{
+    I = tipl::image<3,tipl::rgb>(dim);
+    if(dir.empty())
+        return;
+    float max_value = 0.0f;
+    for(size_t index = 0;index < dir.size();++index)
+        max_value = std::max<float>(max_value,dir[index][0]+dir[index][1]+dir[index][2]);
+    tipl::par_for(dir.size(),[&](size_t index)
+    {
+        float sum = dir[index][0]+dir[index][1]+dir[index][2];
+        if(sum == 0.0f)
+            return;
+        tipl::vector<3> v(dir[index]);
+        sum = v.normalize();
+        v *= 255.0f*std::log(200.0f*sum/max_value+1)/2.303f;
+        I[index] = tipl::rgb(uint8_t(std::min<float>(255,v[0])),uint8_t(std::min<float>(255,v[1])),uint8_t(std::min<float>(255,v[2])));
+    });
+}
+
+void tract_density::get_mean_length(tipl::image<3>& I) const
+{
+    I = tipl::image<3>(dim);
+    if(length.empty())
+        return;
+    tipl::par_for(length.size(),[&](size_t index)
+    {
+        if(count[index])
+            I[index] = length[index]/float(count[index]);
+    });
+}
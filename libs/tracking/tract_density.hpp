@@ -0,0 +1,44 @@
+#ifndef TRACT_DENSITY_HPP
+#define TRACT_DENSITY_HPP
+#include <vector>
+#include "TIPL/tipl.hpp"
+
+/*
+ tract density (TDI) maps accumulated in one pass over the tracts. each thread
+ records its voxel hits in buckets split by volume tile, and the tiles are then
+ reduced in parallel, so no voxel is written by two threads. tracts can be added
+ in batches (one model at a time, or as they are read) without extra memory.
+ */
+class tract_density{
+public:
+    enum map_type{count_map = 1,end_map = 2,dir_map = 4,end_dir_map = 8,length_map = 16};
+private:
+    tipl::shape<3> dim;
+    tipl::matrix<4,4> trans;
+    tipl::vector<3> vs;
+    unsigned int maps;
+    size_t tile_size,tile_count;
+    struct tile_hits{
+        std::vector<size_t> count,end;
+        std::vector<std::pair<size_t,tipl::vector<3> > > dir;
+        std::vector<std::pair<size_t,float> > length;
+    };
+    std::vector<std::vector<tile_hits> > hits; // [thread][tile]
+    bool get_index(tipl::vector<3> p,size_t& index) const;
+    void add(const std::vector<float>& tract,std::vector<tile_hits>& out,std::vector<size_t>& voxels) const;
+    void reduce(void);
+public:
+    tipl::image<3,unsigned int> count,end_count;
+    tipl::image<3,tipl::vector<3> > dir;
+    tipl::image<3> length; // sum of the lengths (mm) of the passing tracts
+public:
+    // trans: tract coordinates to the output grid (may supersample). vs: voxel size of the tract space
+    tract_density(const tipl::shape<3>& dim_,const tipl::matrix<4,4>& trans_,const tipl::vector<3>& vs_,unsigned int maps_);
+    void add(const std::vector<std::vector<float> >& tracts);
+    // voxels already in the output grid, e.g. from TractModel::to_voxel
+    void add(const std::vector<tipl::vector<3,short> >& voxels,map_type map);
+    void get_rgb(tipl::image<3,tipl::rgb>& I) const;
+    void get_mean_length(tipl::image<3>& I) const;
+};
+
+#endif//TRACT_DENSITY_HPP
@@ -0,0 +1,107 @@
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include "tract_lod.hpp"
+
+void get_tract_lod_error(const std::vector<float>& tract,std::vector<float>& error)
+{
+    size_t n = tract.size()/3;
+    error.assign(n,0.0f);
+    if(n == 0)
+        return;
+    error.front() = error.back() = std::numeric_limits<float>::max();
+    // from, to, and the error of the point that split this segment
+    std::vector<std::tuple<size_t,size_t,float> > segments;
+    segments.push_back(std::make_tuple(size_t(0),n-1,std::numeric_limits<float>::max()));
+    while(!segments.empty())
+    {
+        size_t from,to;
+        float parent_error;
+        std::tie(from,to,parent_error) = segments.back();
+        segments.pop_back();
+        if(to <= from+1)
+            continue;
+        tipl::vector<3> a(&tract[from*3]),ab(&tract[to*3]);
+        ab -= a;
+        float ab2 = ab*ab;
+        size_t max_index = from+1;
+        float max_dis2 = -1.0f;
+        for(size_t i = from+1;i < to;++i)
+        {
+            tipl::vector<3> ap(&tract[i*3]);
+            ap -= a;
+            if(ab2 > 0.0f)
+                ap -= ab*std::min<float>(1.0f,std::max<float>(0.0f,(ap*ab)/ab2));
+            float dis2 = ap*ap;
+            if(dis2 > max_dis2)
+            {
+                max_dis2 = dis2;
+                max_index = i;
+            }
+        }
+        float e = std::min<float>(parent_error,std::sqrt(max_dis2));
+        error[max_index] = e;
+        segments.push_back(std::make_tuple(from,max_index,e));
+        segments.push_back(std::make_tuple(max_index,to,e));
+    }
+}
+
+uint64_t get_tract_hash(const std::vector<float>& tract)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(auto v : tract)
+        h = tract_lod::combine(h,v);
+    return tract_lod::combine(h,uint64_t(tract.size()));
+}
+
+uint64_t tract_lod::combine(uint64_t h,float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits,&value,sizeof(bits));
+    return combine(h,uint64_t(bits));
+}
+
+float tract_lod::quantize_tolerance(float tolerance)
+{
+    // below this, simplification saves little and adds work
+    if(!(tolerance >= 0.0625f))
+        return 0.0f;
+    return std::exp2(std::floor(std::log2(std::min<float>(tolerance,16.0f))));
+}
+
+void tract_lod::update(const std::vector<std::vector<float> >& tracts,const std::vector<unsigned int>& index)
+{
+    if(error.size() != tracts.size())
+    {
+        error.resize(tracts.size());
+        hash.resize(tracts.size());
+    }
+    tipl::par_for(index.size(),[&](size_t i)
+    {
+        auto id = index[i];
+        auto h = get_tract_hash(tracts[id]);
+        if(h == hash[id] && error[id].size() == tracts[id].size()/3)
+            return;
+        hash[id] = h;
+        get_tract_lod_error(tracts[id],error[id]);
+    });
+}
+
+void tract_lod::simplify(const std::vector<float>& tract,unsigned int index,float tolerance,
+                         std::vector<float>& new_tract,std::vector<float>& values) const
+{
+    const auto& e = error[index];
+    bool has_values = (values.size() == e.size());
+    new_tract.clear();
+    size_t count = 0;
+    for(size_t i = 0,pos = 0;i < e.size();++i,pos += 3)
+        if(e[i] > tolerance)
+        {
+            new_tract.insert(new_tract.end(),tract.begin()+int64_t(pos),tract.begin()+int64_t(pos+3));
+            if(has_values)
+                values[count] = values[i];
+            ++count;
+        }
+    if(has_values)
+        values.resize(count);
+}
@@ -0,0 +1,33 @@
+#ifndef TRACT_LOD_HPP
+#define TRACT_LOD_HPP
+#include <vector>
+#include <cstdint>
+#include "TIPL/tipl.hpp"
+
+/*
+ level of detail for tract rendering. each point stores the Douglas-Peucker error
+ (in voxels) at which it is removed, and a point's error never exceeds that of the
+ point that split its segment. keeping the points with error > tolerance gives the
+ Douglas-Peucker simplification at that tolerance, so one pass serves all levels.
+ */
+void get_tract_lod_error(const std::vector<float>& tract,std::vector<float>& error);
+uint64_t get_tract_hash(const std::vector<float>& tract);
+
+class tract_lod{
+    std::vector<std::vector<float> > error;
+    std::vector<uint64_t> hash;
+public:
+    static uint64_t combine(uint64_t h,uint64_t value){return (h ^ value)*1099511628211ULL;}
+    static uint64_t combine(uint64_t h,float value);
+    // power-of-two tolerance levels, 0: full detail
+    static float quantize_tolerance(float tolerance);
+public:
+    // recompute the errors of the listed tracts whose coordinates changed
+    void update(const std::vector<std::vector<float> >& tracts,const std::vector<unsigned int>& index);
+    uint64_t get_hash(unsigned int index) const{return hash[index];}
+    // simplify a tract and its per-point values (if any) at the given tolerance
+    void simplify(const std::vector<float>& tract,unsigned int index,float tolerance,
+                  std::vector<float>& new_tract,std::vector<float>& values) const;
+};
+
+#endif//TRACT_LOD_HPP
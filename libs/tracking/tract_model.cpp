@@ -1,23 +1,31 @@
 //---------------------------------------------------------------------------
 #include <QString>
+#include <QFile>
 #include <QFileInfo>
 #include <QImage>
 #include <fstream>
 #include <sstream>
 #include <array>
+#include <bitset>
+#include <queue>
 #include <iterator>
 #include <tuple>
 #include <set>
 #include <map>
+#include <numeric>
+#include <limits>
 #include <cmath>
 #include "roi.hpp"
 #include "tract_model.hpp"
+#include "tract_density.hpp"
+#include "tract_resample.hpp"
 #include "fib_data.hpp"
 #include "mapping/atlas.hpp"
 #include "tract_cluster.hpp"
 #include "../../tracking/region/Regions.h"
 #include "tracking_method.hpp"
 #include "reg.hpp"
+#include "zlib.h"
 #include <filesystem>
 
 void prepare_idx(const char* file_name,std::shared_ptr<tipl::io::gz_istream> in);
@@ -25,25 +33,10 @@ void save_idx(const char* file_name,std::shared_ptr<tipl::io::gz_istream> in);
 const tipl::rgb default_tract_color(255,160,60);
 void smoothed_tracks(const std::vector<float>& track,std::vector<float>& smoothed)
 {
-    smoothed.clear();
-    smoothed.resize(track.size());
-    float w[5] = {1.0,2.0,4.0,2.0,1.0};
-    int shift[5] = {-6, -3, 0, 3, 6};
-    for(int index = 0;index < int(track.size());++index)
-    {
-        float sum_w = 0.0;
-        float sum = 0.0;
-        for(int i = 0;i < 5;++i)
-        {
-            int cur_index = index + shift[i];
-            if(cur_index < 0 || cur_index >= int(track.size()))
-                continue;
-            sum += w[i]*track[size_t(cur_index)];
-            sum_w += w[i];
-        }
-        if(sum_w != 0.0f)
-            smoothed[size_t(index)] = sum/sum_w;
-    }
+    static const std::vector<float> kernel = {4.0f,2.0f,1.0f};
+    tract_resample_buffer buf;
+    smoothed = track;
+    smooth_tract(smoothed.data(),smoothed.size()/3,kernel,buf);
 }
 
 /* 1. spatial resolution of 1/32 voxel spacing.
@@ -270,6 +263,86 @@ class TinyTrack{
     }
 };
 
+// uncompressed files are memory-mapped, gzipped files are inflated into memory
+class track_file_buffer{
+    QFile file;
+    std::vector<char> buf;
+public:
+    const char* data = nullptr;
+    size_t size = 0;
+    bool open(const char* file_name)
+    {
+        if(!tipl::ends_with(std::string(file_name),".gz"))
+        {
+            file.setFileName(file_name);
+            if(!file.open(QIODevice::ReadOnly))
+                return false;
+            size = size_t(file.size());
+            if(!size)
+                return true;
+            if((data = reinterpret_cast<const char*>(file.map(0,file.size()))))
+                return true;
+            buf.resize(size);
+            if(file.read(buf.data(),file.size()) != file.size())
+                return false;
+            data = buf.data();
+            return true;
+        }
+        gzFile in = gzopen(file_name,"rb");
+        if(!in)
+            return false;
+        gzbuffer(in,1 << 20);
+        const size_t chunk = 1 << 26;
+        int n = 0;
+        while(1)
+        {
+            buf.resize(size+chunk);
+            n = gzread(in,buf.data()+size,unsigned(chunk));
+            if(n <= 0)
+                break;
+            size += size_t(n);
+        }
+        // a corrupt stream returns -1, a truncated one ends early with Z_BUF_ERROR
+        int error_code = Z_OK;
+        gzerror(in,&error_code);
+        gzclose(in);
+        if(n < 0 || error_code != Z_OK)
+        {
+            buf.clear();
+            size = 0;
+            return false;
+        }
+        buf.resize(size);
+        data = buf.data();
+        return true;
+    }
+};
+// encode tracks in parallel into 128 mb blocks before writing them out
+template<typename stream_type,typename size_fun,typename encode_fun>
+bool write_track_blocks(stream_type& out,tipl::progress& prog,size_t track_count,size_fun&& get_size,encode_fun&& encode)
+{
+    for(size_t cur = 0;prog(cur,track_count);)
+    {
+        size_t total_size = 0;
+        std::vector<size_t> pos;
+        for(size_t i = cur;i < track_count;++i)
+        {
+            pos.push_back(total_size);
+            total_size += get_size(i);
+            if(total_size > 134217728) // 128 mb
+                break;
+        }
+        std::vector<char> out_buf(total_size);
+        tipl::par_for(pos.size(),[&](size_t i)
+        {
+            encode(cur+i,out_buf.data()+pos[i]);
+        });
+        out.write(out_buf.data(),total_size);
+        cur += pos.size();
+    }
+    return !prog.aborted();
+}
+
 struct TrackVis
 {
     char id_string[6] = {'T','R','A','C','K',0};//ID string for track file. The first 5 characters must be "TRACK".
@@ -308,49 +381,60 @@ struct TrackVis
                 std::string& info)
     {
         tipl::progress prog("loading ",std::filesystem::path(file_name).filename().string().c_str());
-        tipl::io::gz_istream in;
-        if (!in.open(file_name))
+        track_file_buffer in;
+        if (!in.open(file_name) || in.size < 1000)
             return false;
-        in.read((char*)this,1000);
+        std::copy(in.data,in.data+1000,(char*)this);
         std::copy(dim,dim+3,geo.begin());
         std::copy(voxel_size,voxel_size+3,vs.begin());
         std::copy(&vox_to_ras[0][0],&vox_to_ras[0][0]+16,trans_to_mni.begin());
-        unsigned int track_number = n_count;
+        size_t track_number = n_count;
         info = reserved;
         if(info.find(' ') != std::string::npos)
             info.clear();
         if(!track_number) // number is not stored
             track_number = 100000000;
-        for (unsigned int index = 0;!(!in) && prog(index,track_number);++index)
+
+        // locate each record from its point count, then decode them in parallel
+        size_t index_shift = 3 + size_t(n_scalars);
+        std::vector<size_t> pos;
+        for(size_t i = 1000;i+sizeof(uint32_t) <= in.size && pos.size() < track_number;)
         {
-            unsigned int n_point;
-            in.read((char*)&n_point,sizeof(int));
-            unsigned int index_shift = 3 + n_scalars;
-            std::vector<float> tract(index_shift*n_point + n_properties);
-            if(!in.read((char*)&*tract.begin(),sizeof(float)*tract.size()))
+            uint32_t n_point;
+            std::copy(in.data+i,in.data+i+sizeof(uint32_t),(char*)&n_point);
+            size_t next = i+sizeof(uint32_t)+sizeof(float)*(index_shift*size_t(n_point)+size_t(n_properties));
+            if(next > in.size)
                 break;
-
-            loaded_tract_data.push_back(std::vector<float>(n_point*3));
-            const float *from = &*tract.begin();
-            float *to = &*loaded_tract_data.back().begin();
-            for (unsigned int i = 0;i < n_point;++i,from += index_shift,to += 3)
+            pos.push_back(i);
+            i = next;
+        }
+        size_t add_tract_index = loaded_tract_data.size();
+        size_t add_cluster_index = loaded_tract_cluster.size();
+        loaded_tract_data.resize(add_tract_index+pos.size());
+        if(n_properties == 1)
+            loaded_tract_cluster.resize(add_cluster_index+pos.size());
+        bool flip_x = (voxel_order[1] == 'R');
+        bool flip_y = (voxel_order[1] == 'A');
+        tipl::par_for(pos.size(),[&](size_t index)
+        {
+            uint32_t n_point;
+            std::copy(in.data+pos[index],in.data+pos[index]+sizeof(uint32_t),(char*)&n_point);
+            const float *from = reinterpret_cast<const float*>(in.data+pos[index]+sizeof(uint32_t));
+            auto& tract = loaded_tract_data[add_tract_index+index];
+            tract.resize(size_t(n_point)*3);
+            float *to = tract.data();
+            for (size_t i = 0;i < n_point;++i,from += index_shift,to += 3)
             {
                 float x = from[0]/voxel_size[0];
                 float y = from[1]/voxel_size[1];
                 float z = from[2]/voxel_size[2];
-                if(voxel_order[1] == 'R')
-                    to[0] = dim[0]-x-1;
-                else
-                    to[0] = x;
-                if(voxel_order[1] == 'A')
-                    to[1] = dim[1]-y-1;
-                else
-                    to[1] = y;
+                to[0] = flip_x ? dim[0]-x-1 : x;
+                to[1] = flip_y ? dim[1]-y-1 : y;
                 to[2] = z;
             }
             if(n_properties == 1)
-                loaded_tract_cluster.push_back(from[0]);
-        }
+                loaded_tract_cluster[add_cluster_index+index] = (unsigned int)from[0];
+        });
         return !prog.aborted();
     }
     static bool save_to_file(const char* file_name,
@@ -375,11 +459,14 @@ struct TrackVis
         if(info.length())
             std::copy(info.begin(),info.begin()+std::min<int>(439,info.length()),trk.reserved);
         out.write((const char*)&trk,1000);
-        for (unsigned int i = 0;prog(i,tract_data.size());++i)
+        return write_track_blocks(out,prog,tract_data.size(),[&](size_t i)
         {
-            int n_point = tract_data[i].size()/3;
-            std::vector<float> buffer(trk.n_scalars ? tract_data[i].size()+scalar[i].size() : tract_data[i].size());
-            float* to = &*buffer.begin();
+            return sizeof(int)+sizeof(float)*(trk.n_scalars ? tract_data[i].size()+scalar[i].size() : tract_data[i].size());
+        },[&](size_t i,char* buf)
+        {
+            int n_point = int(tract_data[i].size()/3);
+            std::copy((const char*)&n_point,(const char*)&n_point+sizeof(int),buf);
+            float* to = reinterpret_cast<float*>(buf+sizeof(int));
             for (unsigned int flag = 0,j = 0,k = 0;j < tract_data[i].size();++j,++to)
             {
                 *to = tract_data[i][j]*vs[flag];
@@ -395,12 +482,7 @@ struct TrackVis
                     }
                 }
             }
-            out.write((const char*)&n_point,sizeof(int));
-            out.write((const char*)&*buffer.begin(),sizeof(float)*buffer.size());
-        }
-        if(prog.aborted())
-            return false;
-        return true;
+        });
     }
 };
 
@@ -442,30 +524,88 @@ struct Tck{
             }
         }
 
-        std::ifstream in(file_name,std::ios::binary);
-        if(!in)
+        track_file_buffer in;
+        if(!in.open(file_name) || in.size < size_t(offset)+16)
             return false;
-        in.seekg(0,std::ios::end);
-        unsigned int total_size = uint32_t(in.tellg());
-        in.seekg(offset,std::ios::beg);
-        std::vector<unsigned int> buf((total_size-offset)/4);
-        in.read((char*)&*buf.begin(),total_size-offset-16);// 16 skip the final inf
-        for(unsigned int index = 0;index < buf.size();)
+        // data end before the final inf, as 32-bit words
+        size_t word_count = (in.size-offset-16)/4;
+        std::vector<uint32_t> aligned_buf;
+        const uint32_t* buf = reinterpret_cast<const uint32_t*>(in.data+offset);
+        if(offset % 4)
+        {
+            aligned_buf.resize(word_count);
+            std::copy(in.data+offset,in.data+offset+word_count*4,(char*)aligned_buf.data());
+            buf = aligned_buf.data();
+        }
+        // scan for NaN delimiters in parallel chunks
+        size_t chunk_count = std::max<size_t>(1,tipl::max_thread_count);
+        std::vector<std::vector<size_t> > chunk_nan(chunk_count);
+        tipl::par_for(chunk_count,[&](size_t c)
+        {
+            for(size_t i = word_count*c/chunk_count,end = word_count*(c+1)/chunk_count;i < end;++i)
+                if(buf[i] == 0x7FC00000) // NaN
+                    chunk_nan[c].push_back(i);
+        });
+        std::vector<std::pair<size_t,size_t> > range;
         {
-            unsigned int end = std::find(buf.begin()+index,buf.end(),0x7FC00000)-buf.begin(); // NaN
-            if(end-index > 3)
+            std::vector<size_t> nan_pos;
+            for(auto& each : chunk_nan)
+                nan_pos.insert(nan_pos.end(),each.begin(),each.end());
+            auto iter = nan_pos.begin();
+            for(size_t index = 0;index < word_count;)
             {
-                std::vector<float> track(end-index);
-                std::copy((const float*)&*buf.begin() + index,
-                          (const float*)&*buf.begin() + end,
-                          track.begin());
-                loaded_tract_data.push_back(std::move(track));
-                tipl::divide_constant(loaded_tract_data.back().begin(),loaded_tract_data.back().end(),vs[0]);
+                iter = std::lower_bound(iter,nan_pos.end(),index);
+                size_t end = (iter == nan_pos.end() ? word_count : *iter);
+                if(end-index > 3)
+                    range.push_back(std::make_pair(index,end));
+                index = end+3;
             }
-            index = end+3;
         }
+        size_t add_tract_index = loaded_tract_data.size();
+        loaded_tract_data.resize(add_tract_index+range.size());
+        tipl::par_for(range.size(),[&](size_t i)
+        {
+            auto& track = loaded_tract_data[add_tract_index+i];
+            track.resize(range[i].second-range[i].first);
+            std::copy(reinterpret_cast<const float*>(buf) + range[i].first,
+                      reinterpret_cast<const float*>(buf) + range[i].second,
+                      track.begin());
+            tipl::divide_constant(track.begin(),track.end(),vs[0]);
+        });
         return true;
     }
+    static bool save_to_file(const char* file_name,
+                             tipl::shape<3> geo,
+                             tipl::vector<3> vs,
+                             const std::vector<std::vector<float> >& tract_data)
+    {
+        tipl::progress prog("saving ",std::filesystem::path(file_name).filename().string().c_str());
+        std::ofstream out(file_name, std::ios::binary);
+        if(!out)
+            return false;
+        std::array<char, 200> header;
+        std::sprintf(header.data(), "mrtrix tracks\ndatatype: Float32LE\ndim: %d,%d,%d\nvox: %f,%f,%f\ndatatype: Float32LE\nfile: . 200\ncount: %d\nEND\n",
+                     geo[0], geo[1], geo[2], vs[0], vs[1], vs[2], static_cast<int>(tract_data.size()));
+        out.write(header.data(), header.size());
+
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        const float inf = std::numeric_limits<float>::infinity();
+        if(!write_track_blocks(out,prog,tract_data.size(),[&](size_t i)
+            {
+                return sizeof(float)*(tract_data[i].size()+3);
+            },[&](size_t i,char* buf)
+            {
+                float* to = reinterpret_cast<float*>(buf);
+                for(auto v : tract_data[i])
+                    *(to++) = v*vs[0];
+                to[0] = to[1] = to[2] = nan;
+            }))
+            return false;
+        out.write(reinterpret_cast<const char*>(&inf),sizeof(inf));
+        out.write(reinterpret_cast<const char*>(&inf),sizeof(inf));
+        out.write(reinterpret_cast<const char*>(&inf),sizeof(inf));
+        return bool(out);
+    }
 
 };
 
@@ -857,6 +997,7 @@ bool TractModel::load_tracts_from_file(const char* file_name_,fib_data* handle,b
 
 
     loaded_tract_data.swap(tract_data);
+    clear_slice_index();
     tract_color.clear();
     tract_color.resize(tract_data.size());
     if(color)
@@ -1017,30 +1158,7 @@ bool TractModel::save_tracts_to_file(const char* file_name_)
                 tract_data,std::vector<std::vector<float> >(),parameter_id,tract_color.front());
     }
     if(tipl::ends_with(file_name,".tck"))
-    {
-        std::ofstream out(file_name.c_str(), std::ios::binary);
-        if(!out)
-            return false;
-        std::array<char, 200> header;
-        std::sprintf(header.data(), "mrtrix tracks\ndatatype: Float32LE\ndim: %d,%d,%d\nvox: %f,%f,%f\ndatatype: Float32LE\nfile: . 200\ncount: %d\nEND\n",
-                     geo[0], geo[1], geo[2], vs[0], vs[1], vs[2], static_cast<int>(tract_data.size()));
-        out.write(header.data(), header.size());
-
-        const float nan = std::numeric_limits<float>::quiet_NaN();
-        const float inf = std::numeric_limits<float>::infinity();
-        for (const auto& t : tract_data) {
-            std::vector<float> buf(t);
-            tipl::multiply_constant(buf, vs[0]);
-            out.write(reinterpret_cast<const char*>(buf.data()), buf.size() * sizeof(float));
-            out.write(reinterpret_cast<const char*>(&nan),sizeof(nan));
-            out.write(reinterpret_cast<const char*>(&nan),sizeof(nan));
-            out.write(reinterpret_cast<const char*>(&nan),sizeof(nan));
-        }
-        out.write(reinterpret_cast<const char*>(&inf),sizeof(inf));
-        out.write(reinterpret_cast<const char*>(&inf),sizeof(inf));
-        out.write(reinterpret_cast<const char*>(&inf),sizeof(inf));
-        return true;
-    }
+        return Tck::save_to_file(file_name.c_str(),geo,vs,tract_data);
 
     if (tipl::ends_with(file_name,".txt"))
     {
@@ -1471,37 +1589,25 @@ bool TractModel::save_end_points(const char* file_name_) const
     return true;
 }
 //---------------------------------------------------------------------------
-void TractModel::resample(float new_step)
+void TractModel::resample(float new_step,bool catmull_rom)
 {
-    tipl::par_for(tract_data.size(),[&](size_t i)
+    clear_slice_index();
+    std::vector<tract_resample_buffer> buf(tipl::max_thread_count);
+    tipl::par_for<tipl::sequential_with_id>(tract_data.size(),[&](size_t i,size_t thread)
     {
-        if(tract_data[i].size() <= 6)
-            return;
-        std::vector<float> new_tracts;
-        float d = 0.0;
-        new_tracts.push_back(tract_data[i][0]);
-        new_tracts.push_back(tract_data[i][1]);
-        new_tracts.push_back(tract_data[i][2]);
-        for (unsigned int j = 3;j < tract_data[i].size();j += 3)
-        {
-            tipl::vector<3> p(&tract_data[i][j-3]),dis(&tract_data[i][j]);
-            dis -= p;
-            float step = float(dis.length());
-            dis *= new_step/step;
-            while(d+new_step < step)
-            {
-                p += dis;
-                d += new_step;
-                new_tracts.push_back(p[0]);
-                new_tracts.push_back(p[1]);
-                new_tracts.push_back(p[2]);
-            }
-            d -= step;
-        }
-        new_tracts.push_back(tract_data[i][tract_data[i].size()-3]);
-        new_tracts.push_back(tract_data[i][tract_data[i].size()-2]);
-        new_tracts.push_back(tract_data[i][tract_data[i].size()-1]);
-        new_tracts.swap(tract_data[i]);
+        resample_tract(tract_data[i],new_step,buf[thread],catmull_rom);
+    });
+}
+//---------------------------------------------------------------------------
+void TractModel::smooth(float sigma)
+{
+    clear_slice_index();
+    std::vector<float> kernel;
+    get_gaussian_kernel(sigma,kernel);
+    std::vector<tract_resample_buffer> buf(tipl::max_thread_count);
+    tipl::par_for<tipl::sequential_with_id>(tract_data.size(),[&](size_t i,size_t thread)
+    {
+        smooth_tract(tract_data[i].data(),tract_data[i].size()/3,kernel,buf[thread]);
     });
 }
 //---------------------------------------------------------------------------
@@ -1515,6 +1621,15 @@ void TractModel::get_tract_points(std::vector<tipl::vector<3,float> >& points)
         }
 }
 //---------------------------------------------------------------------------
+void TractModel::clear_slice_index(void)
+{
+    std::lock_guard<std::mutex> lock(slice_index_mutex);
+    for(auto& each : slice_index)
+    {
+        each.tract_count = 0;
+        each.slab.clear();
+    }
+}
 void TractModel::get_in_slice_tracts(unsigned char dim,int pos,
                                      tipl::matrix<4,4>* pT,
                                      std::vector<std::vector<tipl::vector<2,float> > >& lines,
@@ -1523,52 +1638,95 @@ void TractModel::get_in_slice_tracts(unsigned char dim,int pos,
                                      int track_color_style,
                                      bool& terminated)
 {
-
-    std::vector<tipl::vector<2,float> > line;
-    std::vector<unsigned int> color;
-
-    auto add_line = [&](unsigned int index)
+    std::lock_guard<std::mutex> lock(slice_index_mutex);
+    auto& index = slice_index[dim];
+    if(index.has_T != (pT != nullptr) || (pT && index.T != *pT) || index.tract_count > tract_data.size())
+    {
+        index.has_T = (pT != nullptr);
+        if(pT)
+            index.T = *pT;
+        index.tract_count = 0;
+        index.slab.clear();
+    }
+    auto get_slice = [&](const float* p)
     {
-        if(line.empty() || index >= tract_color.size())
-            return;
-        lines.push_back(std::move(line));
-        colors.push_back(std::move(color));
-        line.clear();
+        tipl::vector<3> t(p);
+        if(pT)
+            t.to(*pT);
+        return int(std::round(t[dim]));
     };
-
-    auto add_color = [&](tipl::vector<3>&& pos,tipl::vector<3>& prev_pos)
+    // index the tracts added since the last call
+    if(index.tract_count < tract_data.size())
     {
-        prev_pos -= pos;
-        prev_pos.abs();
-        prev_pos *= 200.0f/float(prev_pos.length());
-        color.push_back(uint32_t(tipl::rgb(uint8_t(prev_pos[0]),uint8_t(prev_pos[1]),uint8_t(prev_pos[2]))));
-        prev_pos = pos;
-    };
+        size_t from = index.tract_count,to = tract_data.size();
+        size_t block_count = std::min<size_t>(to-from,tipl::max_thread_count*4);
+        std::vector<std::map<int,std::vector<std::pair<uint32_t,uint32_t> > > > block_slab(block_count);
+        tipl::par_for(block_count,[&](size_t b)
+        {
+            for(size_t i = from+(to-from)*b/block_count;i < from+(to-from)*(b+1)/block_count;++i)
+            {
+                const auto& tract = tract_data[i];
+                if(tract.size() < 6)
+                    continue;
+                size_t count = tract.size()/3;
+                for(size_t j = 0;j < count;)
+                {
+                    int s = get_slice(&tract[j*3]);
+                    size_t k = j+1;
+                    while(k < count && get_slice(&tract[k*3]) == s)
+                        ++k;
+                    if(k-j >= 2) // a single point draws nothing
+                        block_slab[b][s].push_back(std::make_pair(uint32_t(i),uint32_t(j)));
+                    j = k;
+                }
+            }
+        });
+        for(auto& each : block_slab)
+            for(auto& slab : each)
+            {
+                auto& dest = index.slab[slab.first];
+                dest.insert(dest.end(),slab.second.begin(),slab.second.end());
+            }
+        index.tract_count = to;
+    }
 
+    auto iter = index.slab.find(pos);
+    if(iter == index.slab.end())
+        return;
     unsigned int skip = std::max<unsigned int>(1,uint32_t(tract_data.size())/max_count);
-    for (unsigned int index = 0;!terminated && index < tract_data.size();add_line(index),index += skip)
+    for(const auto& run : iter->second)
     {
-        const auto& tract = tract_data[index];
-        if(tract.size() < 6)
+        if(terminated)
+            break;
+        if(run.first % skip || run.first >= tract_color.size())
             continue;
-        tipl::vector<3> prev_pos(&tract[3]);
-        for (unsigned int j = 0;j < tract.size();j += 3)
+        const auto& tract = tract_data[run.first];
+        std::vector<tipl::vector<2,float> > line;
+        std::vector<unsigned int> color;
+        tipl::vector<3> prev_pos;
+        for(size_t j = run.second*3;j < tract.size();j += 3)
         {
             tipl::vector<3> t(&tract[j]);
             if(pT)
                 t.to(*pT);
-            if(int(std::round(t[dim])) == pos)
+            if(int(std::round(t[dim])) != pos)
+                break;
+            line.push_back(tipl::space2slice<tipl::vector<2,float> >(dim,t));
+            if(track_color_style)
+                color.push_back(tract_color[run.first]);
+            else
             {
-                auto p = tipl::space2slice<tipl::vector<2,float> >(dim,t);
-                line.push_back(p);
-                if(track_color_style)
-                    color.push_back(tract_color[index]);
-                else
-                    add_color(std::move(t),prev_pos);
+                // the color of a point is the direction from the previous point
+                auto dir = line.size() == 1 ? tipl::vector<3>() : prev_pos-t;
+                dir.abs();
+                if(dir.length() > 0.0)
+                    dir *= 200.0f/float(dir.length());
+                color.push_back(uint32_t(tipl::rgb(uint8_t(dir[0]),uint8_t(dir[1]),uint8_t(dir[2]))));
             }
-            else
-                add_line(index);
+            prev_pos = t;
         }
+        lines.push_back(std::move(line));
+        colors.push_back(std::move(color));
     }
 }
 //---------------------------------------------------------------------------
@@ -1634,6 +1792,7 @@ void TractModel::release_tracts(std::vector<std::vector<float> >& released_track
 //---------------------------------------------------------------------------
 void TractModel::clear(void)
 {
+    clear_slice_index();
     tract_data.clear();
     tract_color.clear();
     tract_tag.clear();
@@ -1642,6 +1801,7 @@ void TractModel::clear(void)
 //---------------------------------------------------------------------------
 void TractModel::erase_empty(void)
 {
+    clear_slice_index();
     tract_color.erase(std::remove_if(tract_color.begin(),tract_color.end(),
                         [&](const unsigned int& data){return tract_data[&data-&tract_color[0]].empty();}), tract_color.end());
     tract_tag.erase(std::remove_if(tract_tag.begin(),tract_tag.end(),
@@ -2023,131 +2183,170 @@ bool TractModel::filter_by_roi(std::shared_ptr<RoiMgr> roi_mgr)
 //---------------------------------------------------------------------------
 bool TractModel::reconnect_track(float distance,float angular_threshold)
 {
-    if(distance >= 2.0f)
-        return reconnect_track(distance*0.5f,angular_threshold);
-    bool has_merged = false;
-    std::vector<std::vector<uint32_t> > endpoint_map(geo.size());
-    for (unsigned int index = 0;index < tract_data.size();++index)
+    if(!(distance > 0.0f))
+        return false;
+    // endpoint e = tract*2+side, side 0: first point, 1: last point
+    struct endpoint_type{
+        uint64_t cell;
+        uint32_t id;
+        tipl::vector<3> pos,dir; // dir points into the tract
+    };
+    auto get_cell = [&](const tipl::vector<3>& p,int dx,int dy,int dz)
+    {
+        const int64_t offset = 1 << 20;
+        return (uint64_t(int64_t(std::floor(p[0]/distance))+dx+offset) << 42) |
+               (uint64_t(int64_t(std::floor(p[1]/distance))+dy+offset) << 21) |
+                uint64_t(int64_t(std::floor(p[2]/distance))+dz+offset);
+    };
+    std::vector<endpoint_type> ends;
+    for(uint32_t index = 0;index < tract_data.size();++index)
         if(tract_data[index].size() > 6)
+            for(uint32_t side = 0;side < 2;++side)
+            {
+                const float* p = side ? &tract_data[index][tract_data[index].size()-3] : &tract_data[index][0];
+                endpoint_type e;
+                e.id = index*2+side;
+                e.pos = tipl::vector<3>(p);
+                e.dir = tipl::vector<3>(side ? p-3 : p+3);
+                e.dir -= e.pos;
+                e.dir.normalize();
+                e.cell = get_cell(e.pos,0,0,0);
+                ends.push_back(e);
+            }
+    // voxel hash of cell size = distance: sorted by cell, so each cell is a contiguous range
+    std::sort(ends.begin(),ends.end(),[](const endpoint_type& a,const endpoint_type& b)
+    {
+        return a.cell < b.cell || (a.cell == b.cell && a.id < b.id);
+    });
+
+    // candidate joins from the 27 neighboring cells, computed in parallel
+    struct join_type{
+        float dis,alignment;
+        uint32_t e1,e2;
+        bool operator<(const join_type& rhs) const
         {
-            tipl::vector<3,float> end1(&tract_data[index][0]);
-            tipl::vector<3,float> end2(&tract_data[index][tract_data[index].size()-3]);
-            end1 /= distance;
-            end2 /= distance;
-            end1.round();
-            end2.round();
-            if(geo.is_valid(end1))
-                endpoint_map[tipl::pixel_index<3>(end1[0],end1[1],end1[2],geo).index()].push_back(index);
-            if(geo.is_valid(end2))
-                endpoint_map[tipl::pixel_index<3>(end2[0],end2[1],end2[2],geo).index()].push_back(index);
+            if(dis != rhs.dis)
+                return dis < rhs.dis;
+            if(alignment != rhs.alignment)
+                return alignment > rhs.alignment;
+            return e1 < rhs.e1 || (e1 == rhs.e1 && e2 < rhs.e2);
         }
-    tipl::par_for(endpoint_map.size(),[&](size_t index)
+    };
+    std::vector<std::vector<join_type> > thread_joins(tipl::max_thread_count);
+    tipl::par_for<tipl::sequential_with_id>(ends.size(),[&](size_t i,size_t thread)
     {
-        if(endpoint_map[index].size() <= 1)
-            return;
-        std::set<uint32_t> sorted_list(endpoint_map[index].begin(),endpoint_map[index].end());
-        endpoint_map[index] = std::vector<uint32_t>(sorted_list.begin(),sorted_list.end());
-    });
-    // 0: track1 beg
-    // 1: track1 end
-    // 2: track2 beg
-    // 3: track2 end
-    const int compare_pair[4][2] = {{0,2},{0,3},{1,2},{1,3}}; // for checking which end to connect
-    for (size_t pos = 0;pos < geo.size();++pos)
-        if(endpoint_map[pos].size() >= 2)
+        const auto& a = ends[i];
+        for(int dz = -1;dz <= 1;++dz)
+        for(int dy = -1;dy <= 1;++dy)
+        for(int dx = -1;dx <= 1;++dx)
         {
-            std::vector<uint32_t>& track_list = endpoint_map[pos];
-            std::map<float,std::tuple<uint32_t,uint32_t,uint32_t> > merge_list;
-            for(uint32_t i = 0;i < track_list.size();++i)
-                for(uint32_t j = i+1;j < track_list.size();++j)
-                {
-                    uint32_t t1 = track_list[i];
-                    uint32_t t2 = track_list[j];
-                    if(tract_data[t1].size() <= 6 || tract_data[t2].size() <= 6)
-                        continue;
-                    tipl::vector<3,float> end[4],dir[4];
-                    end[0] = &tract_data[t1][0];  // 0: track1 beg
-                    end[1] = &tract_data[t1][tract_data[t1].size()-3]; // 1: track1 end
-                    end[2] = &tract_data[t2][0];  // 2: track2 beg
-                    end[3] = &tract_data[t2][tract_data[t2].size()-3]; // 3: track2 end
-                    dir[0] = &tract_data[t1][3];
-                    dir[1] = &tract_data[t1][tract_data[t1].size()-6];
-                    dir[2] = &tract_data[t2][3];
-                    dir[3] = &tract_data[t2][tract_data[t2].size()-6];
-                    for(uint32_t k = 0;k < 4;++k)
-                    {
-                        dir[k] -= end[k];
-                        dir[k].normalize();
-                    }
-                    for(uint32_t k = 0;k < 4;++k)
-                    {
-                        int p1 = compare_pair[k][0];
-                        int p2 = compare_pair[k][1];
-                        if(std::fabs(end[p1][0]-end[p2][0]) > distance)
-                            continue;
-                        tipl::vector<3> dis_end = end[p1]-end[p2];
-                        float dis = float(dis_end.length());
-                        if(dis > distance)
-                            continue;
-                        float angle = -(dir[p1]*dir[p2]);
-                        if(angle < angular_threshold)
-                            continue;
-                        dis_end.normalize();
-                        float angle1 = dis_end*dir[p1];
-                        if(angle1 < angular_threshold)
-                            continue;
-                        float angle2 = -dis_end*dir[p2];
-                        if(angle2 < angular_threshold)
-                            continue;
-                        merge_list[dis*angle*angle1*angle2] = std::make_tuple(i,j,k);
-                        break;
-                    }
-                }
-            std::vector<char> merged(track_list.size());
-            for(auto& iter : merge_list)
+            auto cell = get_cell(a.pos,dx,dy,dz);
+            auto iter = std::lower_bound(ends.begin(),ends.end(),cell,
+                                         [](const endpoint_type& e,uint64_t c){return e.cell < c;});
+            for(;iter != ends.end() && iter->cell == cell;++iter)
             {
-                uint32_t i = std::get<0>(iter.second);
-                uint32_t j = std::get<1>(iter.second);
-                uint32_t k = std::get<2>(iter.second);
-                if(merged[i] || merged[j])
+                const auto& b = *iter;
+                // each pair once, never within the same tract
+                if((b.id >> 1) <= (a.id >> 1))
                     continue;
-                merged[i] = 1;
-                merged[j] = 1;
-                uint32_t t1 = track_list[i];
-                uint32_t t2 = track_list[j];
-                // reverse track
-                if(k == 1)// k = 1: track1 beg connects tract2 end
-                {
-                    tract_data[t2].insert(tract_data[t2].end(),tract_data[t1].begin(),tract_data[t1].end());
-                    tract_data[t1].clear();
-                    has_merged = true;
+                tipl::vector<3> dis_end = a.pos-b.pos;
+                float dis = float(dis_end.length());
+                if(dis > distance)
                     continue;
-                }
-
-                if(k == 0 || k == 3)
+                float angle = -(a.dir*b.dir);
+                if(angle < angular_threshold)
+                    continue;
+                float angle1 = 1.0f,angle2 = 1.0f;
+                if(dis > 0.0f)
                 {
-                    auto rt = ((k == 0) ? t1 : t2);
-                    float* beg1 = &tract_data[rt][0];
-                    float* end1 = &tract_data[rt][tract_data[rt].size()-3];
-                    while(beg1 < end1)
-                    {
-                        std::swap(beg1[0],end1[0]);
-                        std::swap(beg1[1],end1[1]);
-                        std::swap(beg1[2],end1[2]);
-                        beg1 += 3;
-                        end1 -= 3;
-                    }
+                    dis_end.normalize();
+                    angle1 = dis_end*a.dir;
+                    if(angle1 < angular_threshold)
+                        continue;
+                    angle2 = -dis_end*b.dir;
+                    if(angle2 < angular_threshold)
+                        continue;
                 }
-                // k = 0: track1 beg connects tract2 beg (track1 reversed)
-                // k = 2: track1 end connects tract2 beg
-                // k = 3: track1 end connects tract2 end (track2 reversed)
-                tract_data[t1].insert(tract_data[t1].end(),tract_data[t2].begin(),tract_data[t2].end());
-                tract_data[t2].clear();
-                has_merged = true;
+                thread_joins[thread].push_back(join_type{dis,angle*angle1*angle2,a.id,b.id});
             }
         }
+    });
+    std::vector<join_type> joins;
+    for(auto& each : thread_joins)
+        joins.insert(joins.end(),each.begin(),each.end());
+    if(joins.empty())
+        return false;
+    std::sort(joins.begin(),joins.end());
+
+    // greedy matching: each endpoint joins once, and union-find keeps chains from closing into loops
+    const uint32_t none = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> partner(tract_data.size()*2,none),chain(tract_data.size());
+    std::iota(chain.begin(),chain.end(),0);
+    auto find_chain = [&](uint32_t t)
+    {
+        while(chain[t] != t)
+            t = chain[t] = chain[chain[t]];
+        return t;
+    };
+    bool has_merged = false;
+    for(const auto& j : joins)
+    {
+        if(partner[j.e1] != none || partner[j.e2] != none)
+            continue;
+        auto c1 = find_chain(j.e1 >> 1),c2 = find_chain(j.e2 >> 1);
+        if(c1 == c2)
+            continue;
+        // the root stays the lowest tract of the chain
+        chain[std::max(c1,c2)] = std::min(c1,c2);
+        partner[j.e1] = j.e2;
+        partner[j.e2] = j.e1;
+        has_merged = true;
+    }
+    if(!has_merged)
+        return false;
+
+    // each chain starts from the free end of its lowest end tract
+    std::vector<uint32_t> heads,chain_start(tract_data.size(),none);
+    for(uint32_t t = 0;t < tract_data.size();++t)
+    {
+        chain[t] = find_chain(t);
+        bool joined1 = partner[t*2] != none,joined2 = partner[t*2+1] != none;
+        if(joined1 != joined2 && chain_start[chain[t]] == none)
+        {
+            chain_start[chain[t]] = joined1 ? t*2+1 : t*2;
+            heads.push_back(chain[t]);
+        }
+    }
+    std::sort(heads.begin(),heads.end());
+
+    // build all joined tracts in one batch
+    std::vector<std::vector<float> > joined(heads.size());
+    tipl::par_for(heads.size(),[&](size_t h)
+    {
+        auto start = chain_start[heads[h]];
+        size_t size = 0;
+        for(uint32_t e = start;e != none;e = partner[e^1])
+            size += tract_data[e >> 1].size();
+        auto& out = joined[h];
+        out.reserve(size);
+        for(uint32_t e = start;e != none;e = partner[e^1])
+        {
+            const auto& tract = tract_data[e >> 1];
+            if(e & 1) // entering from the last point
+                for(size_t k = tract.size();k;k -= 3)
+                    out.insert(out.end(),tract.begin()+int64_t(k-3),tract.begin()+int64_t(k));
+            else
+                out.insert(out.end(),tract.begin(),tract.end());
+        }
+    });
+    // the joined tract takes the slot (and color) of the lowest tract in its chain
+    for(uint32_t t = 0;t < tract_data.size();++t)
+        if(chain_start[chain[t]] != none)
+            tract_data[t].clear();
+    for(size_t h = 0;h < heads.size();++h)
+        tract_data[heads[h]].swap(joined[h]);
     erase_empty();
-    return has_merged;
+    return true;
 }
 //---------------------------------------------------------------------------
 bool TractModel::cull(float select_angle,
@@ -2228,6 +2427,7 @@ void TractModel::cut_by_mask(const char*)
 //---------------------------------------------------------------------------
 void TractModel::flip(char dim)
 {
+    clear_slice_index();
     auto w = geo[dim];
     tipl::par_for (tract_data.size(),[&](size_t index)
     {
@@ -2499,71 +2699,20 @@ void TractModel::add_tracts(std::vector<std::vector<float> >& new_tract, unsigne
 void TractModel::get_density_map(tipl::image<3,unsigned int>& mapping,
                                  const tipl::matrix<4,4>& to_t1t2,bool endpoint)
 {
-    tipl::shape<3> geo = mapping.shape();
-    tipl::par_for(tract_data.size(),[&](unsigned int i)
-    {
-        std::set<size_t> point_set;
-        for (unsigned int j = 0;j < tract_data[i].size();j+=3)
-        {
-            if(j && endpoint)
-                j = uint32_t(tract_data[i].size())-3;
-            tipl::vector<3,float> pos(tract_data[i].begin()+j);
-            pos.to(to_t1t2);
-            pos.round();
-            tipl::vector<3,int> ipos(pos);
-            if (geo.is_valid(ipos))
-                point_set.insert(tipl::voxel2index(ipos.begin(),mapping.shape()));
-        }
-
-        for(auto pos : point_set)
-            ++mapping[pos];
-    });
+    tract_density density(mapping.shape(),to_t1t2,vs,endpoint ? tract_density::end_map : tract_density::count_map);
+    density.add(tract_data);
+    const auto& I = endpoint ? density.end_count : density.count;
+    for(size_t index = 0;index < I.size();++index)
+        mapping[index] += I[index];
 }
 //---------------------------------------------------------------------------
 void TractModel::get_density_map(
         tipl::image<3,tipl::rgb>& mapping,
         const tipl::matrix<4,4>& to_t1t2,bool endpoint)
 {
-    tipl::shape<3> geo = mapping.shape();
-    tipl::image<3> map_r(geo),map_g(geo),map_b(geo);
-    std::cout << "aggregating tracts to voxels" << std::endl;
-    tipl::par_for (tract_data.size(),[&](unsigned int i)
-    {
-        const float* buf = &*tract_data[i].begin();
-        for (unsigned int j = 3;j < tract_data[i].size();j+=3)
-        {
-            if(j > 3 && endpoint)
-                j = uint32_t(tract_data[i].size()-3);
-            tipl::vector<3,float>  pos(buf+j),dir(buf+j-3);
-            pos.to(to_t1t2);
-            dir.to(to_t1t2);
-            dir -= pos;
-            dir.normalize();
-            pos.round();
-            tipl::vector<3,int> ipos(pos);
-            if (!geo.is_valid(ipos))
-                continue;
-            size_t ptr = tipl::voxel2index(ipos.begin(),mapping.shape());
-            map_r[ptr] += std::fabs(dir[0]);
-            map_g[ptr] += std::fabs(dir[1]);
-            map_b[ptr] += std::fabs(dir[2]);
-        }
-    });
-    std::cout << "generating rgb maps" << std::endl;
-    float max_value = 0.0f;
-    for(size_t index = 0;index < mapping.size();++index)
-        max_value = std::max<float>(max_value,map_r[index]+map_g[index]+map_b[index]);
-
-    tipl::par_for(mapping.size(),[&](size_t index)
-    {
-        float sum = map_r[index]+map_g[index]+map_b[index];
-        if(sum == 0.0f)
-            return;
-        tipl::vector<3> v(map_r[index],map_g[index],map_b[index]);
-        sum = v.normalize();
-        v*=255.0f*std::log(200.0f*sum/max_value+1)/2.303f;
-        mapping[index] = tipl::rgb(uint8_t(std::min<float>(255,v[0])),uint8_t(std::min<float>(255,v[1])),uint8_t(std::min<float>(255,v[2])));
-    });
+    tract_density density(mapping.shape(),to_t1t2,vs,endpoint ? tract_density::end_dir_map : tract_density::dir_map);
+    density.add(tract_data);
+    density.get_rgb(mapping);
 }
 bool TractModel::export_end_pdi(
                        const char* file_name,
@@ -2575,25 +2724,15 @@ bool TractModel::export_end_pdi(
     auto vs = tract_models.front()->vs;
     auto trans_to_mni = tract_models.front()->trans_to_mni;
     auto is_mni = tract_models.front()->is_mni;
-    tipl::image<3,uint32_t> p1_map(dim),p2_map(dim);
+    tract_density density(dim,tipl::identity_matrix(),vs,tract_density::count_map | tract_density::end_map);
     for(size_t index = 0;index < tract_models.size();++index)
     {
         std::vector<tipl::vector<3,short> > p1,p2;
         tract_models[index]->to_end_point_voxels(p1,p2,tipl::identity_matrix(),end_distance);
-        tipl::par_for(p1.size(),[&](size_t j)
-        {
-            tipl::vector<3,short> p = p1[j];
-            if(dim.is_valid(p))
-                p1_map[tipl::pixel_index<3>(p[0],p[1],p[2],dim).index()]++;
-        });
-        tipl::par_for(p2.size(),[&](size_t j)
-        {
-            tipl::vector<3,short> p = p2[j];
-            if(dim.is_valid(p))
-                p2_map[tipl::pixel_index<3>(p[0],p[1],p[2],dim).index()]++;
-        });
+        density.add(p1,tract_density::count_map);
+        density.add(p2,tract_density::end_map);
     }
-    tipl::image<3> pdi1(p1_map),pdi2(p2_map);
+    tipl::image<3> pdi1(density.count),pdi2(density.end_count);
     if(tract_models.size() > 1)
     {
         tipl::multiply_constant(pdi1,1.0f/float(tract_models.size()));
@@ -2613,19 +2752,14 @@ bool TractModel::export_pdi(const char* file_name,
     auto vs = tract_models.front()->vs;
     auto trans_to_mni = tract_models.front()->trans_to_mni;
     auto is_mni = tract_models.front()->is_mni;
-    tipl::image<3,uint32_t> accumulate_map(dim);
+    tract_density density(dim,tipl::identity_matrix(),vs,tract_density::count_map);
     for(size_t index = 0;index < tract_models.size();++index)
     {
         std::vector<tipl::vector<3,short> > points;
         tract_models[index]->to_voxel(points);
-        tipl::par_for(points.size(),[&](size_t j)
-        {
-            tipl::vector<3,short> p = points[j];
-            if(dim.is_valid(p))
-                accumulate_map[tipl::pixel_index<3>(p[0],p[1],p[2],dim).index()]++;
-        });
+        density.add(points,tract_density::count_map);
     }
-    tipl::image<3> pdi(accumulate_map);
+    tipl::image<3> pdi(density.count);
     if(tract_models.size() > 1)
         tipl::multiply_constant(pdi,1.0f/float(tract_models.size()));
     return tipl::io::gz_nifti::save_to_file(file_name,pdi,vs,trans_to_mni,is_mni);
@@ -2636,25 +2770,38 @@ bool TractModel::export_tdi(const char* filename,
                   tipl::vector<3,float> vs,
                   const tipl::matrix<4,4>& trans_to_mni,
                   const tipl::matrix<4,4>& to_t1t2,
-                  bool color,bool end_point)
+                  bool color,bool end_point,bool mean_length)
 {
     if(!QFileInfo(filename).fileName().endsWith(".nii") &&
        !QFileInfo(filename).fileName().endsWith(".nii.gz"))
         return false;
+    if(tract_models.empty())
+        return false;
+    unsigned int maps = 0;
+    if(color)
+        maps = end_point ? tract_density::end_dir_map : tract_density::dir_map;
+    else
+    if(mean_length)
+        maps = tract_density::length_map;
+    else
+        maps = end_point ? tract_density::end_map : tract_density::count_map;
+    // all models go through one set of accumulators
+    tract_density density(dim,to_t1t2,tract_models[0]->vs,maps);
+    for(unsigned int index = 0;index < tract_models.size();++index)
+        density.add(tract_models[index]->get_tracts());
     if(color)
     {
-        tipl::image<3,tipl::rgb> tdi(dim);
-        for(unsigned int index = 0;index < tract_models.size();++index)
-            tract_models[index]->get_density_map(tdi,to_t1t2,end_point);
+        tipl::image<3,tipl::rgb> tdi;
+        density.get_rgb(tdi);
         return tipl::io::gz_nifti::save_to_file(filename,tdi,vs,trans_to_mni,tract_models[0]->is_mni);
     }
-    else
+    if(mean_length)
     {
-        tipl::image<3,unsigned int> tdi(dim);
-        for(unsigned int index = 0;index < tract_models.size();++index)
-            tract_models[index]->get_density_map(tdi,to_t1t2,end_point);
+        tipl::image<3> tdi;
+        density.get_mean_length(tdi);
         return tipl::io::gz_nifti::save_to_file(filename,tdi,vs,trans_to_mni,tract_models[0]->is_mni);
     }
+    return tipl::io::gz_nifti::save_to_file(filename,end_point ? density.end_count : density.count,vs,trans_to_mni,tract_models[0]->is_mni);
 }
 void TractModel::to_voxel(std::vector<tipl::vector<3,short> >& points,const tipl::matrix<4,4>& trans,int id)
 {
@@ -3038,20 +3185,32 @@ void TractModel::get_quantitative_info(std::shared_ptr<fib_data> handle,std::str
 
     // output mean and std of each index
     {
-        std::vector<float> mean_values(handle->view_item.size());
-        tipl::par_for(handle->view_item.size(),[&](size_t data_index)
+        std::vector<unsigned int> index_list;
+        for(size_t data_index = 0;data_index < handle->view_item.size();++data_index)
+            if(handle->view_item[data_index].name != "color")
+                index_list.push_back(uint32_t(data_index));
+
+        // all metrics are sampled in one pass, and the sums are added in tract order
+        std::vector<std::vector<double> > tract_sum(tract_data.size());
+        tipl::par_for(tract_data.size(),[&](size_t i)
         {
-            if(handle->view_item[data_index].name == "color")
-                return;
-            get_tracts_data(handle,uint32_t(data_index),mean_values[data_index]);
+            std::vector<float> tract_values;
+            get_tract_data(handle,uint32_t(i),index_list,tract_values);
+            tract_sum[i].resize(index_list.size());
+            for(size_t j = 0;j < tract_values.size();j += index_list.size())
+                for(size_t m = 0;m < index_list.size();++m)
+                    tract_sum[i][m] += double(tract_values[j+m]);
         });
-
-        for(size_t data_index = 0;data_index < handle->view_item.size();++data_index)
+        size_t total = 0;
+        std::vector<double> sum_data(index_list.size());
+        for(size_t i = 0;i < tract_data.size();++i)
         {
-            if(handle->view_item[data_index].name == "color")
-                continue;
-            data.push_back(mean_values[data_index]);
+            for(size_t m = 0;m < index_list.size();++m)
+                sum_data[m] += tract_sum[i][m];
+            total += tract_data[i].size()/3;
         }
+        for(size_t m = 0;m < index_list.size();++m)
+            data.push_back(total == 0 ? 0.0f : float(sum_data[m]/double(total)));
         handle->get_index_list(titles);
     }
 
@@ -3086,6 +3245,19 @@ tipl::vector<3> TractModel::get_report(std::shared_ptr<fib_data> handle,
                             std::vector<float>& data_profile,
                             std::vector<float>& data_ci1,
                             std::vector<float>& data_ci2)
+{
+    if(tract_data.empty())
+        return tipl::vector<3>();
+    std::vector<std::vector<float> > data;
+    get_tracts_data(handle,index_name,data);
+    return get_report(profile_dir,band_width,std::move(data),values,data_profile,data_ci1,data_ci2);
+}
+tipl::vector<3> TractModel::get_report(unsigned int profile_dir,float band_width,
+                            std::vector<std::vector<float> > data,
+                            std::vector<float>& values,
+                            std::vector<float>& data_profile,
+                            std::vector<float>& data_ci1,
+                            std::vector<float>& data_ci2)
 {
     tipl::vector<3> avg_dir;
     if(tract_data.empty())
@@ -3117,10 +3289,6 @@ tipl::vector<3> TractModel::get_report(std::shared_ptr<fib_data> handle,
     data_profile.resize(profile_width);
 
     {
-        std::vector<std::vector<float> > data;
-        get_tracts_data(handle,index_name,data);
-
-
         if(profile_on_length == 2)// list the mean fa value of each tract
         {
             data_profile.resize(data.size());
@@ -3132,11 +3300,24 @@ tipl::vector<3> TractModel::get_report(std::shared_ptr<fib_data> handle,
         {
             std::vector<char> dir;
             avg_dir = get_tract_dir(tract_data,dir);
-            std::vector<std::set<float> > profile_upper_ci(profile_width),profile_lower_ci(profile_width);
             size_t ci_size = std::max<size_t>(1,size_t(float(data.size())*0.025f));
 
-            for(size_t i = 0;i < data.size();++i)
+            // each thread accumulates the profile sum and keeps the ci_size largest (min-heap)
+            // and smallest (max-heap) tract values of each bin. the heaps are merged afterward.
+            struct profile_accumulator{
+                std::vector<double> sum;
+                std::vector<std::vector<float> > upper_ci,lower_ci;
+            };
+            std::vector<profile_accumulator> acc(tipl::max_thread_count);
+            tipl::par_for<tipl::sequential_with_id>(data.size(),[&](size_t i,size_t thread)
             {
+                auto& cur = acc[thread];
+                if(cur.sum.empty())
+                {
+                    cur.sum.resize(profile_width);
+                    cur.upper_ci.resize(profile_width);
+                    cur.lower_ci.resize(profile_width);
+                }
                 std::vector<float> line_profile(profile_width);
                 std::vector<float> line_profile_w(profile_width);
                 if(profile_on_length == 1 && !dir[i])
@@ -3158,40 +3339,72 @@ tipl::vector<3> TractModel::get_report(std::shared_ptr<fib_data> handle,
                             line_profile[pos-k] += dw;
                             line_profile_w[pos-k] += w;
                         }
-                        if(pos+k < data_profile.size())
+                        if(pos+k < profile_width)
                         {
                             line_profile[pos+k] += dw;
                             line_profile_w[pos+k] += w;
                         }
                     }
                 }
-                for(unsigned int j = 0;j < line_profile.size();++j)
+                for(size_t j = 0;j < line_profile.size();++j)
                 {
                     float value = (line_profile_w[j] == 0.0f ? 0.0f : line_profile[j] / line_profile_w[j]);
+                    cur.sum[j] += double(value);
 
-                    if(profile_upper_ci[j].size() < ci_size || value < *profile_upper_ci[j].begin())
-                        profile_upper_ci[j].insert(value);
-                    if(profile_lower_ci[j].size() < ci_size || value > *std::prev(profile_lower_ci[j].end()))
-                        profile_lower_ci[j].insert(value);
-
-                    if(profile_upper_ci[j].size() > ci_size)
-                        profile_upper_ci[j].erase(profile_upper_ci[j].begin());
-
-                    if(profile_lower_ci[j].size() > ci_size)
-                        profile_lower_ci[j].erase(std::prev(profile_lower_ci[j].end()));
+                    auto& upper = cur.upper_ci[j];
+                    if(upper.size() < ci_size)
+                    {
+                        upper.push_back(value);
+                        std::push_heap(upper.begin(),upper.end(),std::greater<float>());
+                    }
+                    else
+                    if(value > upper.front())
+                    {
+                        std::pop_heap(upper.begin(),upper.end(),std::greater<float>());
+                        upper.back() = value;
+                        std::push_heap(upper.begin(),upper.end(),std::greater<float>());
+                    }
 
-                    data_profile[j] += value;
+                    auto& lower = cur.lower_ci[j];
+                    if(lower.size() < ci_size)
+                    {
+                        lower.push_back(value);
+                        std::push_heap(lower.begin(),lower.end());
+                    }
+                    else
+                    if(value < lower.front())
+                    {
+                        std::pop_heap(lower.begin(),lower.end());
+                        lower.back() = value;
+                        std::push_heap(lower.begin(),lower.end());
+                    }
                 }
-            }
-            data_ci1.resize(data_profile.size());
-            data_ci2.resize(data_profile.size());
-            for(unsigned int j = 0;j < data_profile.size();++j)
+            });
+
+            data_ci1.resize(profile_width);
+            data_ci2.resize(profile_width);
+            tipl::par_for(profile_width,[&](size_t j)
             {
+                double sum = 0.0;
+                std::vector<float> upper,lower;
+                for(const auto& cur : acc)
+                    if(!cur.sum.empty())
+                    {
+                        sum += cur.sum[j];
+                        upper.insert(upper.end(),cur.upper_ci[j].begin(),cur.upper_ci[j].end());
+                        lower.insert(lower.end(),cur.lower_ci[j].begin(),cur.lower_ci[j].end());
+                    }
                 values[j] = float(j)/detail;
-                data_profile[j] /= data.size();
-                data_ci1[j] = *profile_upper_ci[j].begin();
-                data_ci2[j] = *std::prev(profile_upper_ci[j].end());
-            }
+                data_profile[j] = data.empty() ? 0.0f : float(sum/double(data.size()));
+                if(upper.empty())
+                    return;
+                // the ci_size-th largest and smallest values across all tracts
+                size_t n = std::min<size_t>(ci_size,upper.size())-1;
+                std::nth_element(upper.begin(),upper.begin()+int64_t(n),upper.end(),std::greater<float>());
+                std::nth_element(lower.begin(),lower.begin()+int64_t(n),lower.end());
+                data_ci1[j] = upper[n];
+                data_ci2[j] = lower[n];
+            });
         }
     }
     return avg_dir;
@@ -3230,60 +3443,91 @@ void gradient(input_iterator from,input_iterator to,output_iterator out)
 }
 
 void TractModel::get_tract_data(std::shared_ptr<fib_data> handle,unsigned int fiber_index,unsigned int index_num,std::vector<float>& data) const
+{
+    get_tract_data(handle,fiber_index,std::vector<unsigned int>(1,index_num),data);
+}
+void TractModel::get_tract_data(std::shared_ptr<fib_data> handle,unsigned int fiber_index,
+                                const std::vector<unsigned int>& index_list,std::vector<float>& data) const
 {
     data.clear();
-    if(tract_data[fiber_index].empty())
+    if(tract_data[fiber_index].empty() || index_list.empty())
         return;
-    unsigned int count = uint32_t(tract_data[fiber_index].size()/3);
-    data.resize(count);
-    // track specific index
-    if(index_num < handle->dir.index_data.size())
-    {
-        auto base_image = tipl::make_image(handle->dir.index_data[index_num][0],handle->dim);
-        std::vector<tipl::vector<3,float> > gradient(count);
-        auto tract_ptr = reinterpret_cast<const float (*)[3]>(&(tract_data[fiber_index][0]));
-        ::gradient(tract_ptr,tract_ptr+count,gradient.begin());
-        for (unsigned int point_index = 0,tract_index = 0;
-             point_index < count;++point_index,tract_index += 3)
+    const size_t metric_count = index_list.size();
+    const size_t count = tract_data[fiber_index].size()/3;
+    const float* tract_ptr = &(tract_data[fiber_index][0]);
+    data.resize(count*metric_count);
+
+    // metric 0: track specific, 1: voxel-based in the native space, 2: voxel-based in other spaces
+    std::vector<unsigned char> metric_type(metric_count);
+    std::vector<tipl::const_pointer_image<3> > metric_image(metric_count);
+    bool has_track_specific = false;
+    for(size_t m = 0;m < metric_count;++m)
+    {
+        auto index_num = index_list[m];
+        if(index_num < handle->dir.index_data.size())
+        {
+            has_track_specific = true;
+            metric_image[m] = tipl::make_image(handle->dir.index_data[index_num][0],handle->dim);
+            continue;
+        }
+        metric_image[m] = handle->view_item[index_num].get_image();
+        metric_type[m] = (metric_image[m].shape() == handle->dim ? 1 : 2);
+    }
+
+    std::vector<tipl::vector<3,float> > gradient;
+    if(has_track_specific)
+    {
+        gradient.resize(count);
+        auto ptr = reinterpret_cast<const float (*)[3]>(tract_ptr);
+        ::gradient(ptr,ptr+count,gradient.begin());
+    }
+
+    // interpolation weights and fiber selection are shared by all metrics of a point
+    for(size_t point_index = 0;point_index < count;++point_index)
+    {
+        const float* pos = tract_ptr + point_index + point_index + point_index;
+        float* out = &data[point_index*metric_count];
+        tipl::interpolator::linear<3> tri_interpo;
+        bool inside = tri_interpo.get_location(handle->dim,pos);
+        int fib_order[8];
+        if(has_track_specific && inside)
         {
-            tipl::interpolator::linear<3> tri_interpo;
             gradient[point_index].normalize();
-            if (tri_interpo.get_location(handle->dim,&(tract_data[fiber_index][tract_index])))
+            for(unsigned int index = 0;index < 8;++index)
+                fib_order[index] = handle->dir.get_fib_order(tri_interpo.dindex[index],gradient[point_index]);
+        }
+        for(size_t m = 0;m < metric_count;++m)
+        {
+            if(metric_type[m] == 2)
             {
+                tipl::vector<3> other_pos(pos);
+                other_pos.to(handle->view_item[index_list[m]].iT);
+                tipl::estimate(metric_image[m],other_pos,out[m]);
+                continue;
+            }
+            if(!inside)
+                continue;
+            if(metric_type[m] == 0)
+            {
+                const auto& metrics = handle->dir.index_data[index_list[m]];
                 float value,average_value = 0.0f;
                 float sum_value = 0.0f;
-                for (unsigned int index = 0;index < 8;++index)
+                for(unsigned int index = 0;index < 8;++index)
                 {
-                    if ((value = handle->dir.get_track_specific_metrics(tri_interpo.dindex[index],
-                                                               handle->dir.index_data[index_num],gradient[point_index])) == 0.0f)
+                    if(fib_order[index] < 0 ||
+                       (value = metrics[uint32_t(fib_order[index])][tri_interpo.dindex[index]]) == 0.0f)
                         continue;
                     average_value += value*tri_interpo.ratio[index];
                     sum_value += tri_interpo.ratio[index];
                 }
-                if (sum_value > 0.5f)
-                    data[point_index] = average_value/sum_value;
-                else
-                    tipl::estimate(base_image,&(tract_data[fiber_index][tract_index]),data[point_index]);
-            }
-            else
-                tipl::estimate(base_image,&(tract_data[fiber_index][tract_index]),data[point_index]);
-        }
-    }
-    else
-    // voxel-based index
-    {
-        if(handle->view_item[index_num].get_image().shape() != handle->dim) // other slices
-        {
-            for (unsigned int data_index = 0,index = 0;index < tract_data[fiber_index].size();index += 3,++data_index)
-            {
-                tipl::vector<3> pos(&(tract_data[fiber_index][index]));
-                pos.to(handle->view_item[index_num].iT);
-                tipl::estimate(handle->view_item[index_num].get_image(),pos,data[data_index]);
+                if(sum_value > 0.5f)
+                {
+                    out[m] = average_value/sum_value;
+                    continue;
+                }
             }
+            tri_interpo.estimate(metric_image[m],out[m]);
         }
-        else
-        for (unsigned int data_index = 0,index = 0;index < tract_data[fiber_index].size();index += 3,++data_index)
-            tipl::estimate(handle->view_item[index_num].get_image(),&(tract_data[fiber_index][index]),data[data_index]);
     }
 }
 
@@ -3294,13 +3538,31 @@ bool TractModel::get_tracts_data(std::shared_ptr<fib_data> handle,
     unsigned int index_num = handle->get_name_index(index_name);
     if(index_num == handle->view_item.size())
         return false;
+    get_tracts_data(handle,std::vector<unsigned int>(1,index_num),data);
+    return true;
+}
+void TractModel::get_tracts_data(std::shared_ptr<fib_data> handle,
+        const std::vector<unsigned int>& index_list,
+        std::vector<std::vector<float> >& data) const
+{
     data.clear();
     data.resize(tract_data.size());
     tipl::par_for(tract_data.size(),[&](unsigned int i)
     {
-         get_tract_data(handle,i,index_num,data[i]);
+         get_tract_data(handle,i,index_list,data[i]);
     });
-    return true;
+}
+void TractModel::get_metric_data(const std::vector<std::vector<float> >& all_data,
+                                 size_t metric_count,size_t metric,
+                                 std::vector<std::vector<float> >& data)
+{
+    data.resize(all_data.size());
+    for(size_t i = 0;i < all_data.size();++i)
+    {
+        data[i].resize(all_data[i].size()/metric_count);
+        for(size_t j = 0,pos = metric;j < data[i].size();++j,pos += metric_count)
+            data[i][j] = all_data[i][pos];
+    }
 }
 void TractModel::get_tracts_data(std::shared_ptr<fib_data> handle,unsigned int data_index,float& mean) const
 {
@@ -3767,32 +4029,49 @@ bool ConnectivityMatrix::calculate(std::shared_ptr<fib_data> handle,
 
 }
 template<class matrix_type>
-void distance_bin(const matrix_type& bin,tipl::image<2,float>& D)
+void distance_bin(const matrix_type& bin,tipl::image<2,float>& D,unsigned int thread_count = tipl::max_thread_count)
 {
     unsigned int n = bin.width();
-    tipl::image<2,unsigned int> A,Lpath;
-    A = bin;
-    Lpath = bin;
-    D = bin;
-    for(unsigned int l = 2;1;++l)
-    {
-        tipl::image<2,unsigned int> t(A.shape());
-        tipl::mat::product(Lpath.begin(),A.begin(),t.begin(),tipl::shape<2>(n,n),tipl::shape<2>(n,n));
-        std::swap(Lpath,t);
-        bool con = false;
-        for(unsigned int i = 0;i < D.size();++i)
-            if(Lpath[i] != 0 && D[i] == 0)
-            {
-                D[i] = l;
-                con = true;
-            }
-        if(!con)
-            break;
-    }
+    D.clear();
+    D.resize(bin.shape());
+    std::vector<std::vector<unsigned int> > out(n);
+    for(unsigned int i = 0,index = 0;i < n;++i)
+        for(unsigned int j = 0;j < n;++j,++index)
+            if(bin[index] != 0)
+                out[i].push_back(j);
+    // breadth-first search from each node: the first walk length that reaches a node,
+    // and the diagonal holds the shortest closed walk
+    tipl::par_for(n,[&](unsigned int i)
+    {
+        float* Di = &D[0] + size_t(i)*n;
+        std::vector<unsigned char> visited(n);
+        std::vector<unsigned int> frontier(1,i),next;
+        visited[i] = 1;
+        for(unsigned int l = 1;!frontier.empty();++l)
+        {
+            next.clear();
+            for(auto v : frontier)
+                for(auto w : out[v])
+                {
+                    if(w == i)
+                    {
+                        if(Di[i] == 0.0f)
+                            Di[i] = l;
+                        continue;
+                    }
+                    if(visited[w])
+                        continue;
+                    visited[w] = 1;
+                    Di[w] = l;
+                    next.push_back(w);
+                }
+            frontier.swap(next);
+        }
+    },thread_count);
     std::replace(D.begin(),D.end(),(float)0,std::numeric_limits<float>::max());
 }
 template<class matrix_type>
-void distance_wei(const matrix_type& W_,tipl::image<2,float>& D)
+void distance_wei(const matrix_type& W_,tipl::image<2,float>& D,unsigned int thread_count = tipl::max_thread_count)
 {
     tipl::image<2,float> W(W_);
     for(unsigned int i = 0;i < W.size();++i)
@@ -3801,43 +4080,41 @@ void distance_wei(const matrix_type& W_,tipl::image<2,float>& D)
     D.clear();
     D.resize(W.shape());
     std::fill(D.begin(),D.end(),std::numeric_limits<float>::max());
-    for(unsigned int i = 0,dg = 0;i < n;++i,dg += n + 1)
-        D[dg] = 0;
-    for(unsigned int i = 0,in = 0;i < n;++i,in += n)
-    {
+    std::vector<std::vector<std::pair<unsigned int,float> > > out(n);
+    for(unsigned int i = 0,index = 0;i < n;++i)
+        for(unsigned int j = 0;j < n;++j,++index)
+            if(i != j && W[index] > 0)
+                out[i].push_back(std::make_pair(j,W[index]));
+    // Dijkstra from each node, relaxing only unsettled nodes as the column-clearing version did
+    tipl::par_for(n,[&](unsigned int i)
+    {
+        float* Di = &D[0] + size_t(i)*n;
+        Di[i] = 0;
         std::vector<unsigned char> S(n);
-        tipl::image<2,float> W1(W);
-
-        std::vector<unsigned int> V;
-        V.push_back(i);
-        while(1)
+        std::priority_queue<std::pair<float,unsigned int>,
+                            std::vector<std::pair<float,unsigned int> >,
+                            std::greater<std::pair<float,unsigned int> > > heap;
+        heap.push(std::make_pair(0.0f,i));
+        while(!heap.empty())
         {
-            for(unsigned int j = 0;j < V.size();++j)
-            {
-                S[V[j]] = 1;
-                for(unsigned int k = V[j];k < W1.size();k += n)
-                    W1[k] = 0;
-            }
-            for(unsigned int j = 0;j < V.size();++j)
-            {
-                unsigned int v = V[j];
-                unsigned int vn = v*n;
-                for(unsigned int k = 0;k < n;++k)
-                if(W1[vn+k] > 0)
-                    D[in+k] = std::min<float>(D[in+k],D[in+v]+W1[vn+k]);
-            }
-            float minD = std::numeric_limits<float>::max();
-            for(unsigned int j = 0;j < n;++j)
-                if(S[j] == 0 && minD > D[in+j])
-                    minD = D[in+j];
-            if(minD == std::numeric_limits<float>::max())
-                break;
-            V.clear();
-            for(unsigned int j = 0;j < n;++j)
-                if(D[in+j]  == minD)
-                    V.push_back(j);
+            auto v = heap.top().second;
+            auto dv = heap.top().first;
+            heap.pop();
+            if(S[v] || dv != Di[v])
+                continue;
+            S[v] = 1;
+            for(const auto& e : out[v])
+                if(!S[e.first])
+                {
+                    float d = std::min<float>(Di[e.first],Di[v]+e.second);
+                    if(d < Di[e.first])
+                    {
+                        Di[e.first] = d;
+                        heap.push(std::make_pair(d,e.first));
+                    }
+                }
         }
-    }
+    },thread_count);
     std::replace(D.begin(),D.end(),(float)0.0,std::numeric_limits<float>::max());
 }
 template<class matrix_type>
@@ -3886,16 +4163,30 @@ void ConnectivityMatrix::network_property(std::string& report)
     for(unsigned int i = 0;i < n;++i)
         strength[i] = std::accumulate(norm_matrix.begin()+i*n,norm_matrix.begin()+(i+1)*n,0.0);
     // calculate clustering coefficient
+    std::vector<std::vector<unsigned int> > neighbors(n);
+    for(unsigned int i = 0,index = 0;i < n;++i)
+        for(unsigned int j = 0;j < n;++j,++index)
+            if(binary_matrix[index])
+                neighbors[i].push_back(j);
     std::vector<float> cluster_co(n);
-    for(unsigned int i = 0,posi = 0;i < n;++i,posi += n)
-    if(degree[i] >= 2)
-    {
-        for(unsigned int j = 0,index = 0;j < n;++j)
-            for(unsigned int k = 0;k < n;++k,++index)
-                if(binary_matrix[posi + j] && binary_matrix[posi + k])
-                    cluster_co[i] += binary_matrix[index];
-        float d = degree[i];
-        cluster_co[i] /= (d*d-d);
+    {
+        // triangles counted by intersecting bit rows of the adjacency matrix
+        size_t words = (n+63)/64;
+        std::vector<uint64_t> bits(n*words);
+        for(unsigned int i = 0;i < n;++i)
+            for(auto j : neighbors[i])
+                bits[i*words+j/64] |= uint64_t(1) << (j%64);
+        tipl::par_for(n,[&](unsigned int i)
+        {
+            if(degree[i] < 2)
+                return;
+            size_t count = 0;
+            for(auto j : neighbors[i])
+                for(size_t w = 0;w < words;++w)
+                    count += std::bitset<64>(bits[j*words+w] & bits[i*words+w]).count();
+            float d = degree[i];
+            cluster_co[i] = float(count)/(d*d-d);
+        });
     }
     float cc_bin = tipl::mean(cluster_co.begin(),cluster_co.end());
     out << "clustering_coeff_average(binary)\t" << cc_bin << std::endl;
@@ -3981,61 +4272,48 @@ void ConnectivityMatrix::network_property(std::string& report)
     std::vector<float> local_efficiency_bin(n);
     //calculate local efficiency
     {
-        for(unsigned int i = 0,ipos = 0;i < n;++i,ipos += n)
+        tipl::par_for(n,[&](unsigned int i)
         {
-            unsigned int new_n = std::accumulate(binary_matrix.begin()+ipos,
-                                                 binary_matrix.begin()+ipos+n,0);
+            const auto& nb = neighbors[i];
+            unsigned int new_n = uint32_t(nb.size());
             if(new_n < 2)
-                continue;
+                return;
             tipl::image<2,float> newA(tipl::shape<2>(new_n,new_n));
-            unsigned int pos = 0;
-            for(unsigned int j = 0,index = 0;j < n;++j)
-                for(unsigned int k = 0;k < n;++k,++index)
-                    if(binary_matrix[ipos+j] && binary_matrix[ipos+k])
-                    {
-                        if(pos < newA.size())
-                            newA[pos] = binary_matrix[index];
-                        ++pos;
-                    }
+            for(unsigned int j = 0,pos = 0;j < new_n;++j)
+                for(unsigned int k = 0;k < new_n;++k,++pos)
+                    newA[pos] = binary_matrix[nb[j]*n+nb[k]];
             tipl::image<2,float> invD;
-            distance_bin(newA,invD);
+            distance_bin(newA,invD,1);
             inv_dis(invD,invD);
             local_efficiency_bin[i] = std::accumulate(invD.begin(),invD.end(),0.0)/(new_n*new_n-new_n);
-        }
+        });
     }
 
     std::vector<float> local_efficiency_wei(n);
     {
-
-        for(unsigned int i = 0,ipos = 0;i < n;++i,ipos += n)
+        tipl::par_for(n,[&](unsigned int i)
         {
-            unsigned int new_n = std::accumulate(binary_matrix.begin()+ipos,
-                                                 binary_matrix.begin()+ipos+n,0);
+            size_t ipos = size_t(i)*n;
+            const auto& nb = neighbors[i];
+            unsigned int new_n = uint32_t(nb.size());
             if(new_n < 2)
-                continue;
+                return;
             tipl::image<2,float> newA(tipl::shape<2>(new_n,new_n));
-            unsigned int pos = 0;
-            for(unsigned int j = 0,index = 0;j < n;++j)
-                for(unsigned int k = 0;k < n;++k,++index)
-                    if(binary_matrix[ipos+j] && binary_matrix[ipos+k])
-                    {
-                        if(pos < newA.size())
-                            newA[pos] = norm_matrix[index];
-                        ++pos;
-                    }
+            for(unsigned int j = 0,pos = 0;j < new_n;++j)
+                for(unsigned int k = 0;k < new_n;++k,++pos)
+                    newA[pos] = norm_matrix[nb[j]*n+nb[k]];
             std::vector<float> sw;
-            for(unsigned int j = 0;j < n;++j)
-                if(binary_matrix[ipos+j])
-                    sw.push_back(std::pow(norm_matrix[ipos+j],(float)(1.0/3.0)));
+            for(auto j : nb)
+                sw.push_back(std::pow(norm_matrix[ipos+j],(float)(1.0/3.0)));
             tipl::image<2,float> invD;
-            distance_wei(newA,invD);
+            distance_wei(newA,invD,1);
             inv_dis(invD,invD);
             float numer = 0.0;
             for(unsigned int j = 0,index = 0;j < new_n;++j)
                 for(unsigned int k = 0;k < new_n;++k,++index)
                     numer += std::pow(invD[index],(float)(1.0/3.0))*sw[j]*sw[k];
             local_efficiency_wei[i] = numer/(new_n*new_n-new_n);
-        }
+        });
     }
 
 
@@ -4143,8 +4421,17 @@ void ConnectivityMatrix::network_property(std::string& report)
         unsigned int d = 2;
         for(;std::find(NSPd.begin(),NSPd.end(),1) != NSPd.end();++d)
         {
+            // path counts are integers, so the sparse product gives the same result as the dense one
             tipl::image<2,unsigned int> t(binary_matrix.shape());
-            tipl::mat::product(NPd.begin(),binary_matrix.begin(),t.begin(),tipl::shape<2>(n,n),tipl::shape<2>(n,n));
+            tipl::par_for(n,[&](unsigned int i)
+            {
+                auto NPd_row = NPd.begin()+size_t(i)*n;
+                auto t_row = t.begin()+size_t(i)*n;
+                for(unsigned int k = 0;k < n;++k)
+                    if(NPd_row[k])
+                        for(auto j : neighbors[k])
+                            t_row[j] += NPd_row[k]*binary_matrix[k*n+j];
+            });
             t.swap(NPd);
             for(unsigned int i = 0;i < L.size();++i)
             {
@@ -4182,52 +4469,59 @@ void ConnectivityMatrix::network_property(std::string& report)
     }
     std::vector<float> betweenness_wei(n);
     {
-        for(unsigned int i = 0;i < n;++i)
+        tipl::image<2,float> G(norm_matrix);
+        // per suggestion from Mikail Rubinov, the matrix has to be "granulated"
+        {
+            float eps = max_value*0.001f;
+            for(size_t i = 0;i < G.size();++i)
+                if(G[i] > 0.0f && G[i] < eps)
+                    G[i] = eps;
+        }
+        std::vector<std::vector<std::pair<unsigned int,float> > > out(n);
+        for(unsigned int i = 0,index = 0;i < n;++i)
+            for(unsigned int j = 0;j < n;++j,++index)
+                if(G[index] > 0)
+                    out[i].push_back(std::make_pair(j,G[index]));
+        // each source records its additions, which are replayed in source order
+        // so that the floating point sums match the sequential version
+        std::vector<std::vector<std::pair<unsigned int,float> > > source_add(n);
+        tipl::par_for(n,[&](unsigned int i)
         {
             std::vector<float> D(n),NP(n);
             std::fill(D.begin(),D.end(),std::numeric_limits<float>::max());
             D[i] = 0;
             NP[i] = 1;
-            std::vector<unsigned char> S(n),Q(n);
+            std::vector<unsigned char> S(n);
+            std::vector<unsigned int> Q(n);
             int q = n-1;
             std::fill(S.begin(),S.end(),1);
-            tipl::image<2,unsigned char> P(binary_matrix.shape());
-            tipl::image<2,float> G1(norm_matrix);
-            // per suggestion from Mikail Rubinov, the matrix has to be "granulated"
-            {
-                float eps = max_value*0.001f;
-                for(size_t i = 0;i < G1.size();++i)
-                    if(G1[i] > 0.0f && G1[i] < eps)
-                        G1[i] = eps;
-            }
+            std::vector<std::vector<unsigned int> > P(n);
             std::vector<unsigned int> V;
             V.push_back(i);
-            while(q >= V.size())
+            while(q >= int(V.size()))
             {
-                for(unsigned int j = 0,jpos = 0;j < n;++j,jpos += n)
-                    for(unsigned int k = 0;k < V.size();++k)
-                        G1[jpos+V[k]] = 0;
+                // settled nodes are no longer relaxed
                 for(unsigned int k = 0;k < V.size();++k)
-                {
                     S[V[k]] = 0;
+                for(unsigned int k = 0;k < V.size();++k)
+                {
                     Q[q--]=V[k];
-                    unsigned int v_rowk = V[k]*n;
-                    for(unsigned int w = 0,w_row = 0;w < n;++w, w_row += n)
-                        if(G1[v_rowk+w] > 0)
+                    for(const auto& e : out[V[k]])
+                        if(S[e.first])
                         {
-                            float Duw=D[V[k]]+G1[v_rowk+w];
+                            unsigned int w = e.first;
+                            float Duw=D[V[k]]+e.second;
                             if(Duw < D[w])
                             {
                                 D[w]=Duw;
                                 NP[w]=NP[V[k]];
-                                std::fill(P.begin()+w_row,P.begin()+w_row+n,0);
-                                P[w_row + V[k]] = 1;
+                                P[w].assign(1,V[k]);
                             }
                             else
                             if(Duw==D[w])
                             {
                                 NP[w]+=NP[V[k]];
-                                P[w_row+V[k]]=1;
+                                P[w].push_back(V[k]);
                             }
                         }
                 }
@@ -4254,13 +4548,14 @@ void ConnectivityMatrix::network_property(std::string& report)
             for(unsigned int j = 0;j < n-1;++j)
             {
                 unsigned int w=Q[j];
-                unsigned int w_row = w*n;
-                betweenness_wei[w] += DP[w];
-                for(unsigned int k = 0;k < n;++k)
-                    if(P[w_row+k])
-                        DP[k] += (1.0+DP[w])*NP[k]/NP[w];
+                source_add[i].push_back(std::make_pair(w,DP[w]));
+                for(auto k : P[w])
+                    DP[k] += (1.0+DP[w])*NP[k]/NP[w];
             }
-        }
+        });
+        for(const auto& adds : source_add)
+            for(const auto& each : adds)
+                betweenness_wei[each.first] += each.second;
     }
 
 
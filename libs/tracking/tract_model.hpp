@@ -1,6 +1,8 @@
 #ifndef TRACT_MODEL_HPP
 #define TRACT_MODEL_HPP
 #include <vector>
+#include <map>
+#include <mutex>
 #include <iosfwd>
 #include "fib_data.hpp"
 
@@ -30,6 +32,19 @@ private:
         std::vector<std::pair<unsigned int,unsigned int> > redo_size;
         // offset, size
         void erase_empty(void);
+private:
+        // per-axis slab index for get_in_slice_tracts: for each slice, the tract and first point
+        // of every in-slice run with two or more points. appended tracts extend the index,
+        // and other edits clear it.
+        struct slice_index_type{
+            bool has_T = false;
+            tipl::matrix<4,4> T;
+            size_t tract_count = 0;
+            std::map<int,std::vector<std::pair<uint32_t,uint32_t> > > slab;
+        };
+        slice_index_type slice_index[3];
+        std::mutex slice_index_mutex;
+        void clear_slice_index(void);
 public:
         // for loading multiple clusters
         std::vector<unsigned int> tract_cluster;
@@ -71,6 +86,7 @@ public:
             tract_tag = rhs.tract_tag;
             report = rhs.report;
             saved = true;
+            clear_slice_index();
             return *this;
         }
         void add(const TractModel& rhs);
@@ -123,7 +139,8 @@ public:
         bool trim(void);
         void flip(char dim);
 
-        void resample(float new_step);
+        void resample(float new_step,bool catmull_rom = false);
+        void smooth(float sigma);
         void get_tract_points(std::vector<tipl::vector<3,float> >& points);
         void get_in_slice_tracts(unsigned char dim,int pos,
                                  tipl::matrix<4,4>* T,
@@ -159,7 +176,7 @@ public:
                           tipl::vector<3,float> vs,
                           const tipl::matrix<4,4>& trans_to_mni,
                           const tipl::matrix<4,4>& to_t1t2,
-                               bool color,bool end_point);
+                               bool color,bool end_point,bool mean_length = false);
         static bool export_pdi(const char* file_name,
                                const std::vector<std::shared_ptr<TractModel> >& tract_models);
         static bool export_end_pdi(const char* file_name,
@@ -172,6 +189,12 @@ public:
                         std::vector<float>& data_profile,
                         std::vector<float>& data_ci1,
                         std::vector<float>& data_ci2);
+        tipl::vector<3> get_report(unsigned int profile_dir,float band_width,
+                        std::vector<std::vector<float> > data,
+                        std::vector<float>& values,
+                        std::vector<float>& data_profile,
+                        std::vector<float>& data_ci1,
+                        std::vector<float>& data_ci2);
 
 public:
         void get_tract_data(std::shared_ptr<fib_data> handle,
@@ -182,6 +205,17 @@ public:
                 const std::string& index_name,
                 std::vector<std::vector<float> >& data) const;
         void get_tracts_data(std::shared_ptr<fib_data> handle,unsigned int index_num,float& mean) const;
+        // sample several metrics in one pass: data[tract][point*index_list.size()+metric]
+        void get_tract_data(std::shared_ptr<fib_data> handle,
+                            unsigned int fiber_index,
+                            const std::vector<unsigned int>& index_list,
+                            std::vector<float>& data) const;
+        void get_tracts_data(std::shared_ptr<fib_data> handle,
+                const std::vector<unsigned int>& index_list,
+                std::vector<std::vector<float> >& data) const;
+        static void get_metric_data(const std::vector<std::vector<float> >& all_data,
+                                    size_t metric_count,size_t metric,
+                                    std::vector<std::vector<float> >& data);
 public:
 
         void get_passing_list(const tipl::image<3,std::vector<short> >& region_map,
@@ -0,0 +1,202 @@
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include "tract_resample.hpp"
+
+namespace{
+
+void split_tract(const float* tract,size_t n,tract_resample_buffer& buf)
+{
+    buf.x.resize(n);
+    buf.y.resize(n);
+    buf.z.resize(n);
+    for(size_t i = 0;i < n;++i,tract += 3)
+    {
+        buf.x[i] = tract[0];
+        buf.y[i] = tract[1];
+        buf.z[i] = tract[2];
+    }
+}
+
+// cumulative arc length at each point, returns the total length
+float get_arc_length(tract_resample_buffer& buf)
+{
+    size_t n = buf.x.size();
+    auto& s = buf.arc_length;
+    s.resize(n);
+    s[0] = 0.0f;
+    const float* x = buf.x.data();
+    const float* y = buf.y.data();
+    const float* z = buf.z.data();
+    float* l = s.data()+1;
+    for(size_t i = 0;i+1 < n;++i)
+    {
+        float dx = x[i+1]-x[i],dy = y[i+1]-y[i],dz = z[i+1]-z[i];
+        l[i] = std::sqrt(dx*dx+dy*dy+dz*dz);
+    }
+    for(size_t i = 1;i < n;++i)
+        s[i] += s[i-1];
+    return s[n-1];
+}
+
+// add a sample at arc length v (0 < v < total length)
+void add_sample(tract_resample_buffer& buf,size_t& j,float v)
+{
+    const auto& s = buf.arc_length;
+    while(s[j+1] < v)
+        ++j;
+    buf.segment.push_back(uint32_t(j));
+    buf.t.push_back((v-s[j])/(s[j+1]-s[j]));
+}
+
+// interpolate one coordinate at the samples in buf.segment and buf.t
+void interpolate(const std::vector<float>& c,const tract_resample_buffer& buf,bool catmull_rom,float* out)
+{
+    size_t m = buf.segment.size();
+    const unsigned int* seg = buf.segment.data();
+    const float* t = buf.t.data();
+    if(!catmull_rom)
+    {
+        for(size_t k = 0;k < m;++k)
+            out[k] = c[seg[k]]+t[k]*(c[seg[k]+1]-c[seg[k]]);
+        return;
+    }
+    size_t last = c.size()-1;
+    for(size_t k = 0;k < m;++k)
+    {
+        size_t j = seg[k];
+        float p0 = c[j ? j-1 : 0],p1 = c[j],p2 = c[j+1],p3 = c[std::min(j+2,last)];
+        float tk = t[k],t2 = tk*tk,t3 = t2*tk;
+        out[k] = 0.5f*((2.0f*p1)+(p2-p0)*tk+(2.0f*p0-5.0f*p1+4.0f*p2-p3)*t2+(3.0f*p1-p0-3.0f*p2+p3)*t3);
+    }
+}
+
+// write the end points and interpolated samples back into the tract
+void assemble_tract(std::vector<float>& tract,tract_resample_buffer& buf,bool catmull_rom)
+{
+    size_t m = buf.segment.size();
+    buf.out.resize(m*3);
+    interpolate(buf.x,buf,catmull_rom,buf.out.data());
+    interpolate(buf.y,buf,catmull_rom,buf.out.data()+m);
+    interpolate(buf.z,buf,catmull_rom,buf.out.data()+m+m);
+    size_t n = buf.x.size();
+    tract.resize(m*3+6);
+    tract[0] = buf.x[0];
+    tract[1] = buf.y[0];
+    tract[2] = buf.z[0];
+    float* p = tract.data()+3;
+    for(size_t k = 0;k < m;++k,p += 3)
+    {
+        p[0] = buf.out[k];
+        p[1] = buf.out[k+m];
+        p[2] = buf.out[k+m+m];
+    }
+    p[0] = buf.x[n-1];
+    p[1] = buf.y[n-1];
+    p[2] = buf.z[n-1];
+}
+
+}
+
+void resample_tract(std::vector<float>& tract,float step,tract_resample_buffer& buf,bool catmull_rom)
+{
+    if(tract.size() <= 6 || !(step > 0.0f))
+        return;
+    split_tract(tract.data(),tract.size()/3,buf);
+    float length = get_arc_length(buf);
+    buf.segment.clear();
+    buf.t.clear();
+    size_t j = 0;
+    for(unsigned int k = 1;float(k)*step < length;++k)
+        add_sample(buf,j,float(k)*step);
+    assemble_tract(tract,buf,catmull_rom);
+}
+
+void resample_tract_to(std::vector<float>& tract,unsigned int point_count,tract_resample_buffer& buf,bool catmull_rom)
+{
+    if(tract.size() < 3 || point_count < 2)
+        return;
+    split_tract(tract.data(),tract.size()/3,buf);
+    float length = tract.size() > 3 ? get_arc_length(buf) : 0.0f;
+    buf.segment.clear();
+    buf.t.clear();
+    if(length == 0.0f)
+    {
+        // a single point or coincident points
+        tract.resize(size_t(point_count)*3);
+        for(size_t i = 3;i < tract.size();++i)
+            tract[i] = tract[i-3];
+        return;
+    }
+    size_t j = 0;
+    for(unsigned int k = 1;k+1 < point_count;++k)
+        add_sample(buf,j,length*float(k)/float(point_count-1));
+    assemble_tract(tract,buf,catmull_rom);
+}
+
+void smooth_tract(float* tract,size_t point_count,const std::vector<float>& kernel,tract_resample_buffer& buf)
+{
+    if(point_count < 2 || kernel.size() < 2)
+        return;
+    split_tract(tract,point_count,buf);
+    int n = int(point_count);
+    int h = int(kernel.size())-1;
+    buf.out.resize(point_count);
+    float* out = buf.out.data();
+    const std::vector<float>* coordinates[3] = {&buf.x,&buf.y,&buf.z};
+    for(int d = 0;d < 3;++d)
+    {
+        const float* in = coordinates[d]->data();
+        // ends: only the neighbors within the tract, with the weights renormalized
+        auto smooth_at = [&](int i)
+        {
+            float sum = 0.0f,sum_w = 0.0f;
+            for(int k = -h;k <= h;++k)
+                if(i+k >= 0 && i+k < n)
+                {
+                    float w = kernel[size_t(std::abs(k))];
+                    sum += w*in[i+k];
+                    sum_w += w;
+                }
+            out[i] = sum/sum_w;
+        };
+        int from = std::min(h,n),to = std::max(from,n-h);
+        for(int i = 0;i < from;++i)
+            smooth_at(i);
+        for(int i = to;i < n;++i)
+            smooth_at(i);
+        // interior: full kernel, accumulated one offset at a time
+        if(from < to)
+        {
+            float sum_w = kernel[0];
+            for(int k = 1;k <= h;++k)
+                sum_w += kernel[size_t(k)]+kernel[size_t(k)];
+            std::fill(out+from,out+to,0.0f);
+            for(int k = -h;k <= h;++k)
+            {
+                float w = kernel[size_t(std::abs(k))];
+                const float* src = in+k;
+                for(int i = from;i < to;++i)
+                    out[i] += w*src[i];
+            }
+            for(int i = from;i < to;++i)
+                out[i] /= sum_w;
+        }
+        float* dst = tract+d;
+        for(int i = 0;i < n;++i,dst += 3)
+            *dst = out[i];
+    }
+}
+
+void get_gaussian_kernel(float sigma,std::vector<float>& kernel)
+{
+    kernel.clear();
+    if(!(sigma > 0.0f))
+    {
+        kernel.push_back(1.0f);
+        return;
+    }
+    int h = std::max<int>(1,int(std::ceil(2.0f*sigma)));
+    for(int k = 0;k <= h;++k)
+        kernel.push_back(std::exp(-float(k*k)/(2.0f*sigma*sigma)));
+}
@@ -0,0 +1,28 @@
+#ifndef TRACT_RESAMPLE_HPP
+#define TRACT_RESAMPLE_HPP
+#include <vector>
+#include <cstddef>
+
+/*
+ resampling and smoothing kernels for tracts stored as x,y,z,x,y,z...
+ the coordinates are split into separate x, y, z arrays so that the inner loops
+ vectorize, and the results are written back into the tract. the buffer keeps
+ its capacity between calls; use one per thread.
+ */
+struct tract_resample_buffer{
+    std::vector<float> x,y,z,arc_length,out;
+    std::vector<unsigned int> segment;
+    std::vector<float> t;
+};
+
+// resample by arc length: the first point, a point every step, and the last point
+void resample_tract(std::vector<float>& tract,float step,tract_resample_buffer& buf,bool catmull_rom = false);
+// resample to point_count points evenly spaced by arc length, including both ends
+void resample_tract_to(std::vector<float>& tract,unsigned int point_count,tract_resample_buffer& buf,bool catmull_rom = false);
+// weighted average of neighboring points. kernel holds the center weight followed by
+// the weights of the 1st, 2nd... neighbors, and is renormalized near the ends.
+void smooth_tract(float* tract,size_t point_count,const std::vector<float>& kernel,tract_resample_buffer& buf);
+// kernel for smooth_tract, sigma in number of points
+void get_gaussian_kernel(float sigma,std::vector<float>& kernel);
+
+#endif//TRACT_RESAMPLE_HPP
@@ -11,6 +11,7 @@
 #include <QDir>
 #include <QImageReader>
 #include "mapping/atlas.hpp"
+#include "mapping/mapping_cache.hpp"
 #include "mainwindow.h"
 #include "console.h"
 
@@ -376,6 +377,12 @@ int run_cmd(int ac, char *av[])
         }
         if (!po.check("action"))
             return 1;
+        if(po.has("cache_dir"))
+            mapping_cache::dir = po.get("cache_dir");
+        // also applies to a cache directory set by DSI_STUDIO_CACHE
+        mapping_cache::max_size_mb = po.get("cache_size",mapping_cache::max_size_mb);
+        if(mapping_cache::enabled())
+            tipl::out() << "normalization cache: " << mapping_cache::dir << std::endl;
 
         std::shared_ptr<QApplication> gui;
         std::shared_ptr<QCoreApplication> cmd;
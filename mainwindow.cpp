@@ -489,11 +489,11 @@ QString RenameDICOMToDir(QString FileName, QString ToDir)
         ImageName(imagename.c_str());
         ToDir += "/";
         ToDir += Person;
-        if (!QDir(ToDir).exists() && !std::filesystem::create_directory(std::filesystem::path(ToDir.toStdString())))
-            tipl::out() << "ERROR: cannot create dir " << ToDir.toStdString() << std::endl;
         ToDir += "/";
         ToDir += Sequence;
-        if (!QDir(ToDir).exists() && !std::filesystem::create_directory(std::filesystem::path(ToDir.toStdString())))
+        // files may be renamed concurrently, so an existing directory is not an error
+        std::error_code ec;
+        if (!QDir(ToDir).exists() && !std::filesystem::create_directories(std::filesystem::path(ToDir.toStdString()),ec) && ec)
             tipl::out() << "ERROR: cannot create dir " << ToDir.toStdString() << std::endl;
         ToDir += "/";
         ToDir += ImageName;
@@ -569,17 +569,30 @@ QStringList rename_dicom_at_dir(QString path,QString output)
                     << "source directory is " << path.toStdString() << std::endl
                     << "output directory is " << output.toStdString() << std::endl;
     QStringList dirs = GetSubDir(path);
-    QStringList subject_dirs;
-    for(int index = 0;prog(index,dirs.size());++index)
+    QStringList files;
+    for(const auto& dir : dirs)
+        for(const auto& file : QDir(dir).entryList(QStringList("*"),QDir::Files | QDir::NoSymLinks))
+            files << dir + "/" + file;
+    // reading DICOM headers dominates, so files are renamed concurrently
+    std::vector<QString> new_names(size_t(files.size()));
+    // in batches, so that progress is reported from this thread
+    const size_t batch_size = 256;
+    for(size_t from = 0;from < new_names.size() && prog(from,new_names.size());from += batch_size)
     {
-        QStringList files = QDir(dirs[index]).entryList(QStringList("*"),
-                                    QDir::Files | QDir::NoSymLinks);
-        for(int j = 0;j < files.size() && index < dirs.size();++j)
+        size_t size = std::min<size_t>(batch_size,new_names.size()-from);
+        tipl::par_for(size,[&](size_t j)
         {
-            auto dir = QFileInfo(RenameDICOMToDir(dirs[index] + "/" + files[j],output)).absoluteDir();
-            dir.cdUp();
-            subject_dirs << dir.absolutePath();
-        }
+            new_names[from+j] = RenameDICOMToDir(files[int(from+j)],output);
+        },std::min<size_t>(size,tipl::max_thread_count));
+    }
+    QStringList subject_dirs;
+    for(const auto& name : new_names)
+    {
+        if(name.isEmpty())
+            continue;
+        auto dir = QFileInfo(name).absoluteDir();
+        dir.cdUp();
+        subject_dirs << dir.absolutePath();
     }
     subject_dirs.removeDuplicates();
     return subject_dirs;
@@ -371,29 +371,57 @@ void TractRenderShader::add_shade(std::shared_ptr<TractModel>& active_tract_mode
     }
 }
 
+float TractRender::get_lod_tolerance(const tipl::shape<3>& dim) const
+{
+    const float max_pixel_error = 0.5f;
+    GLfloat mv[16],pj[16];
+    GLint vp[4];
+    glGetFloatv(GL_MODELVIEW_MATRIX,mv);
+    glGetFloatv(GL_PROJECTION_MATRIX,pj);
+    glGetIntegerv(GL_VIEWPORT,vp);
+    // eye-space depth of the volume center, which does not change with rotation
+    float x = float(dim[0])*0.5f,y = float(dim[1])*0.5f,z = float(dim[2])*0.5f;
+    float depth = -(mv[2]*x+mv[6]*y+mv[10]*z+mv[14]);
+    float scale = std::max<float>(std::sqrt(mv[0]*mv[0]+mv[1]*mv[1]+mv[2]*mv[2]),
+                  std::max<float>(std::sqrt(mv[4]*mv[4]+mv[5]*mv[5]+mv[6]*mv[6]),
+                                  std::sqrt(mv[8]*mv[8]+mv[9]*mv[9]+mv[10]*mv[10])));
+    if(depth <= 0.0f || scale == 0.0f)
+        return 0.0f;
+    float pixels_per_voxel = scale*pj[0]*float(vp[2])*0.5f/depth;
+    return tract_lod::quantize_tolerance(max_pixel_error/pixels_per_voxel);
+}
+
 void TractRender::render_tracts(std::shared_ptr<TractModel>& active_tract_model,GLWidget* glwidget,
                             tracking_window& cur_tracking_window)
 {
-    if(!need_update)
+    auto dim = cur_tracking_window.handle->dim;
+    float tolerance = get_lod_tolerance(dim);
+    if(!need_update && tolerance == lod_tolerance)
     {
         for(auto& d: data)
-            d.draw(glwidget);
+            d->draw(glwidget);
         return;
     }
     auto lock = start_reading(false);
     if(!lock.get())
+    {
+        // only the level of detail changed, keep showing the current geometry
+        if(!need_update)
+            for(auto& d: data)
+                d->draw(glwidget);
         return;
+    }
 
     param.init(glwidget,cur_tracking_window);
 
     need_update = false;
+    lod_tolerance = tolerance;
     auto tract_visible_tract = cur_tracking_window["tract_visible_tract"].toInt();
 
 
 
     unsigned int track_num_index = cur_tracking_window.handle->get_name_index(
                                    cur_tracking_window.color_bar->get_tract_color_name().toStdString());
-    auto dim = cur_tracking_window.handle->dim;
 
 
     float skip_rate = float(tract_visible_tract)/float(active_tract_model->get_visible_track_count());
@@ -438,30 +466,88 @@ void TractRender::render_tracts(std::shared_ptr<TractModel>& active_tract_model,
         };
     }
 
-    TractRenderShader shader(dim);
-    if(param.tract_shader)
-        shader.add_shade(active_tract_model,visible);
+    lod.update(active_tract_model->get_tracts(),visible);
 
-    auto thread_count = std::min<int>(6,tipl::max_thread_count);
-    data.clear();
-    data.resize(thread_count);
-    tipl::par_for (thread_count,[&](unsigned int thread)
+    // everything other than the tracts themselves that changes the geometry
+    uint64_t style_key = 14695981039346656037ULL;
     {
-        for(unsigned int i = thread;i < visible.size();i += thread_count)
+        for(float v : {param.tract_alpha,param.tract_color_saturation,param.tract_color_brightness,
+                       param.tube_diameter,lod_tolerance})
+            style_key = tract_lod::combine(style_key,v);
+        for(unsigned char v : {param.tract_style,param.tract_color_style,param.tract_tube_detail,
+                               param.tract_shader,param.end_point_shift})
+            style_key = tract_lod::combine(style_key,uint64_t(v));
+        if(param.tract_color_style == 2)
         {
-            if(about_to_write)
-                break;
-            std::vector<float> metrics;
-            if(param.tract_color_style == 2)
-                active_tract_model->get_tract_data(cur_tracking_window.handle,visible[i],track_num_index,metrics);
-            data[thread].add_tract(param,active_tract_model->get_tract(visible[i]),shader,
-                           assigned_colors.empty() ? tipl::vector<3>() : assigned_colors[i],metrics);
+            style_key = tract_lod::combine(style_key,uint64_t(track_num_index));
+            style_key = tract_lod::combine(style_key,float(param.color_r));
+            style_key = tract_lod::combine(style_key,float(param.color_min));
+            for(unsigned int i = 0;i < 256;++i)
+                for(unsigned int j = 0;j < 3;++j)
+                    style_key = tract_lod::combine(style_key,param.color_map[i][j]);
         }
+        // the shading depends on all visible tracts
+        if(param.tract_shader)
+            for(auto id : visible)
+                style_key = tract_lod::combine(style_key,lod.get_hash(id));
+    }
+
+    size_t block_count = (visible.size()+block_size-1)/block_size;
+    std::vector<uint64_t> new_key(block_count);
+    tipl::par_for(block_count,[&](size_t b)
+    {
+        uint64_t key = style_key;
+        for(size_t i = b*block_size;i < visible.size() && i < (b+1)*block_size;++i)
+        {
+            key = tract_lod::combine(key,uint64_t(visible[i]));
+            key = tract_lod::combine(key,lod.get_hash(visible[i]));
+            if(!assigned_colors.empty())
+                for(unsigned int j = 0;j < 3;++j)
+                    key = tract_lod::combine(key,assigned_colors[i][j]);
+        }
+        new_key[b] = key;
     });
 
-    for(auto& d: data)
+    std::vector<size_t> dirty;
+    data.resize(block_count);
+    data_key.resize(block_count);
+    for(size_t b = 0;b < block_count;++b)
+        if(!data[b].get() || data_key[b] != new_key[b])
+            dirty.push_back(b);
+
+    if(!dirty.empty())
     {
-        d.draw(glwidget);
+        TractRenderShader shader(dim);
+        if(param.tract_shader)
+            shader.add_shade(active_tract_model,visible);
+        tipl::par_for(dirty.size(),[&](size_t k)
+        {
+            auto b = dirty[k];
+            auto new_data = std::make_shared<TractRenderData>();
+            std::vector<float> simplified;
+            for(size_t i = b*block_size;i < visible.size() && i < (b+1)*block_size;++i)
+            {
+                if(about_to_write)
+                {
+                    // incomplete block, rebuild it next time
+                    new_key[b] = 0;
+                    break;
+                }
+                std::vector<float> metrics;
+                if(param.tract_color_style == 2)
+                    active_tract_model->get_tract_data(cur_tracking_window.handle,visible[i],track_num_index,metrics);
+                const auto& tract = active_tract_model->get_tract(visible[i]);
+                if(lod_tolerance > 0.0f)
+                    lod.simplify(tract,visible[i],lod_tolerance,simplified,metrics);
+                new_data->add_tract(param,lod_tolerance > 0.0f ? simplified : tract,shader,
+                               assigned_colors.empty() ? tipl::vector<3>() : assigned_colors[i],metrics);
+            }
+            data[b] = new_data;
+            data_key[b] = new_key[b];
+        });
     }
 
+    for(auto& d: data)
+        d->draw(glwidget);
+
 }
@@ -2,6 +2,7 @@
 #define TRACT_RENDER_HPP
 #include <QtOpenGL>
 #include "tract_model.hpp"
+#include "tract_lod.hpp"
 class tracking_window;
 class GLWidget;
 struct TractRenderParam{
@@ -116,7 +117,13 @@ public:
 struct TractRender{
 public:
     TractRenderParam param;
-    std::vector<TractRenderData> data;
+    // vertex batches of consecutive visible tracts, rebuilt only when their key changes
+    static const size_t block_size = 4096;
+    std::vector<std::shared_ptr<TractRenderData> > data;
+    std::vector<uint64_t> data_key;
+    tract_lod lod;
+    float lod_tolerance = 0.0f;
+    float get_lod_tolerance(const tipl::shape<3>& dim) const;
 public:
     bool terminated = false;
     std::shared_ptr<std::thread> calculation_thread;
@@ -4,6 +4,14 @@
 #include "zlib.h"
 #include "TIPL/tipl.hpp"
 extern bool has_cuda;
+// progress type for registration run outside the main thread, where tipl::progress should not be created
+struct no_progress{
+    template<typename... args_type>
+    no_progress(args_type&&...){}
+    template<typename T,typename U>
+    bool operator()(T,U) const{return true;}
+    bool aborted(void) const{return false;}
+};
 void cdm_cuda(const std::vector<tipl::const_pointer_image<3,float> >& It,
                const std::vector<tipl::const_pointer_image<3,float> >& Is,
                tipl::image<3,tipl::vector<3> >& d,
@@ -17,7 +25,7 @@ void cdm_cuda(const std::vector<tipl::const_pointer_image<2,float> >& It,
                bool& terminated,
                tipl::reg::cdm_param param);
 
-template<int dim>
+template<typename prog_type = tipl::progress,int dim>
 inline void cdm_common(std::vector<tipl::const_pointer_image<dim,float> > It,
                        std::vector<tipl::const_pointer_image<dim,float> > Is,
                        tipl::image<dim,tipl::vector<dim> >& dis,
@@ -28,7 +36,8 @@ inline void cdm_common(std::vector<tipl::const_pointer_image<dim,float> > It,
 {
     if(use_cuda && has_cuda)
     {
-        if constexpr (tipl::use_cuda)
+        // the cuda path reports through tipl::progress
+        if constexpr (tipl::use_cuda && std::is_same_v<prog_type,tipl::progress>)
         {
             cdm_cuda(It,Is,dis,inv_dis,terminated,param);
             return;
@@ -45,7 +54,7 @@ inline void cdm_common(std::vector<tipl::const_pointer_image<dim,float> > It,
         tipl::reg::cdm_mi(sIt,sJ,dis,inv_dis,terminated,param);
     }
     else
-    */    tipl::reg::cdm<tipl::progress,tipl::out>(It,Is,dis,inv_dis,terminated,param);
+    */    tipl::reg::cdm<prog_type,tipl::out>(It,Is,dis,inv_dis,terminated,param);
 }
 
 
@@ -81,7 +90,7 @@ size_t optimize_mi_cuda_mr(std::shared_ptr<tipl::reg::linear_reg_param<3,float,t
                      bool& terminated);
 size_t optimize_mi_cuda_mr(std::shared_ptr<tipl::reg::linear_reg_param<3,unsigned char,tipl::progress> > reg,
                      bool& terminated);
-template<typename value_type,int dim>
+template<typename prog_type = tipl::progress,typename value_type,int dim>
 inline size_t linear_refine(std::vector<tipl::const_pointer_image<dim,value_type> > from,
                             tipl::vector<dim> from_vs,
                             std::vector<tipl::const_pointer_image<dim,value_type> > to,
@@ -91,10 +100,10 @@ inline size_t linear_refine(std::vector<tipl::const_pointer_image<dim,value_type
                             bool& terminated = tipl::prog_aborted,
                             tipl::reg::cost_type cost_type = tipl::reg::mutual_info)
 {
-    auto reg = tipl::reg::linear_reg<tipl::progress>(from,from_vs,to,to_vs,arg);
+    auto reg = tipl::reg::linear_reg<prog_type>(from,from_vs,to,to_vs,arg);
     reg->set_bound(reg_type,tipl::reg::narrow_bound,false);
     size_t result = 0;
-    if constexpr (tipl::use_cuda && dim == 3)
+    if constexpr (tipl::use_cuda && dim == 3 && std::is_same_v<prog_type,tipl::progress>)
     {
         if(has_cuda && cost_type == tipl::reg::mutual_info)
             result = optimize_mi_cuda(reg,terminated);
@@ -121,7 +130,7 @@ inline auto make_list(const image_type& I)
     auto pI = tipl::make_shared(I);
     return std::vector<decltype(pI)>({pI});
 }
-template<typename value_type,int dim>
+template<typename prog_type = tipl::progress,typename value_type,int dim>
 size_t linear(std::vector<tipl::const_pointer_image<dim,value_type> > from,
                              tipl::vector<dim> from_vs,
                              std::vector<tipl::const_pointer_image<dim,value_type> > to,
@@ -143,10 +152,10 @@ size_t linear(std::vector<tipl::const_pointer_image<dim,value_type> > from,
     }
     float result = 0.0f;
 
-    auto reg = tipl::reg::linear_reg<tipl::progress>(from,from_vs,to,new_to_vs,arg);
+    auto reg = tipl::reg::linear_reg<prog_type>(from,from_vs,to,new_to_vs,arg);
     reg->set_bound(reg_type,bound);
 
-    if constexpr (tipl::use_cuda && dim == 3)
+    if constexpr (tipl::use_cuda && dim == 3 && std::is_same_v<prog_type,tipl::progress>)
     {
         if(has_cuda && cost_type == tipl::reg::mutual_info)
             result = optimize_mi_cuda_mr(reg,terminated);
@@ -164,7 +173,7 @@ size_t linear(std::vector<tipl::const_pointer_image<dim,value_type> > from,
     }
     tipl::out() << "initial registration" << std::endl;
     tipl::out() << arg << std::endl;
-    return linear_refine(from,from_vs,to,to_vs,arg,reg_type,terminated,cost_type);
+    return linear_refine<prog_type>(from,from_vs,to,to_vs,arg,reg_type,terminated,cost_type);
 }
 template<typename value_type,int dim>
 tipl::transformation_matrix<float> linear(std::vector<tipl::const_pointer_image<dim,value_type> > from,
@@ -268,10 +277,11 @@ struct dual_reg{
     {
         return linear_reg(reg_type,cost_type,tipl::prog_aborted);
     }
+    template<typename prog_type = tipl::progress>
     float linear_reg(tipl::reg::reg_type reg_type,
                      tipl::reg::cost_type cost_type,bool& terminated)
     {
-        tipl::progress prog("linear registration");
+        prog_type prog("linear registration");
         if(export_intermediate)
         {
             tipl::io::gz_nifti::save_to_file("Template_QA.nii.gz",It,Itvs,ItR);
@@ -282,7 +292,7 @@ struct dual_reg{
                 tipl::io::gz_nifti::save_to_file("Subject_ISO.nii.gz",I2,Ivs,IR);
         }
 
-        linear(make_list(It,It2),Itvs,make_list(I,I2),Ivs,
+        linear<prog_type>(make_list(It,It2),Itvs,make_list(I,I2),Ivs,
                arg,reg_type,terminated,bound,cost_type);
 
         auto trans = T();
@@ -316,10 +326,11 @@ struct dual_reg{
     {
         return nonlinear_reg(tipl::prog_aborted);
     }
+    template<typename prog_type = tipl::progress>
     float nonlinear_reg(bool& terminated)
     {
-        tipl::progress prog("nonlinear registration");
-        cdm_common(make_list(It,It2),make_list(J,J2),t2f_dis,f2t_dis,terminated,param,use_cuda);
+        prog_type prog("nonlinear registration");
+        cdm_common<prog_type>(make_list(It,It2),make_list(J,J2),t2f_dis,f2t_dis,terminated,param,use_cuda);
 
         if(export_intermediate)
         {
@@ -192,7 +192,7 @@ QImage slice_view_scene::get_view_image(std::shared_ptr<SliceModel> current_slic
 {
     QImage new_view_image;
     tipl::color_image slice_image;
-    current_slice->get_slice(slice_image,cur_dim,pos,cur_tracking_window.overlay_slices);
+    slice_cache.get_slice(current_slice,cur_dim,pos,cur_tracking_window.overlay_slices,slice_image);
     if(slice_image.empty())
         return new_view_image;
 
@@ -428,15 +428,40 @@ void slice_view_scene::show_slice(void)
 {
     if(no_show)
         return;
+    complete_view_ready = false;
     need_complete_view = true;
     paint_image(view_image,true);
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    prefetch_slices();
+    // wait up to 100 ms for the complete view, but no longer than it takes
+    for(int i = 0;i < 20 && !complete_view_ready;++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
     if(complete_view_ready)
         show_complete_slice();
     else
         *this << view_image;
 }
 
+void slice_view_scene::prefetch_slices(void)
+{
+    auto current_slice = cur_tracking_window.current_slice;
+    std::vector<std::pair<unsigned char,int> > dim_pos;
+    if(cur_tracking_window["roi_layout"].toInt() == 0)// single slice
+    {
+        unsigned char cur_dim = cur_tracking_window.cur_dim;
+        int pos = current_slice->slice_pos[cur_dim];
+        for(int d : {1,-1,2,-2})
+            dim_pos.push_back(std::make_pair(cur_dim,pos+d));
+    }
+    else
+    if(cur_tracking_window["roi_layout"].toInt() == 1)// 3 slices
+    {
+        for(unsigned char dim = 0;dim < 3;++dim)
+            for(int d : {1,-1})
+                dim_pos.push_back(std::make_pair(dim,current_slice->slice_pos[dim]+d));
+    }
+    slice_cache.prefetch(current_slice,dim_pos,cur_tracking_window.overlay_slices);
+}
+
 void slice_view_scene::show_complete_slice(void)
 {
     complete_view_ready = false;
@@ -463,7 +488,7 @@ void slice_view_scene::paint_image(void)
             complete_view_ready = true;
         }
         while(!need_complete_view && !free_thread)
-            std::this_thread::yield();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
 }
 
@@ -6,10 +6,10 @@
 #include <QEvent>
 #include "zlib.h"
 #include "TIPL/tipl.hpp"
+#include "SliceModel.h"
 
 class fib_data;
 class tracking_window;
-class SliceModel;
 class slice_view_scene : public QGraphicsScene
 {
     Q_OBJECT
@@ -57,6 +57,9 @@ public:
     int view1_w = 0; // for 3 views updating 3D
     void paint_image(QImage& I,bool simple);
     void paint_image(void);
+public:
+    slice_image_cache slice_cache;
+    void prefetch_slices(void);
 public:
     bool show_grid = false;
     void new_annotated_image(void);
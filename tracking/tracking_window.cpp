@@ -653,6 +653,7 @@ tracking_window::~tracking_window()
             tracking_windows[index] = 0;
             break;
         }
+    scene.slice_cache.clear();
     tractWidget->stop_tracking();
     tractWidget->command("delete_all_tract");
     regionWidget->delete_all_region();
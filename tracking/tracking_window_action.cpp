@@ -936,6 +936,7 @@ void tracking_window::on_deleteSlice_clicked()
     if(current_slice->stay)
         on_stay_clicked();
     int index = ui->SliceModality->currentIndex();
+    handle->wait_prefetch();
     handle->view_item.erase(handle->view_item.begin()+index);
     slices.erase(slices.begin()+index);
     glWidget->slice_texture.erase(glWidget->slice_texture.begin()+index);
@@ -1022,6 +1023,7 @@ void tracking_window::on_actionStrip_Skull_triggered()
     if(!run_unet())
         return;
     reg_slice->source_images *= unet->sum;
+    scene.slice_cache.clear();
     slice_need_update = true;
     glWidget->update_slice();
 }
@@ -1453,6 +1455,7 @@ void tracking_window::on_actionMark_Region_on_T1W_T2W_triggered()
     for(size_t i = 0;i < mask.size();++i)
         if(mask[i])
             slice->source_images[i] = mark_value;
+    scene.slice_cache.clear();
     slice_need_update = true;
     glWidget->update();
 }
@@ -1475,6 +1478,7 @@ void tracking_window::on_actionMark_Tracts_on_T1W_T2W_triggered()
     for(size_t i = 0;i < t_mask.size();++i)
         if(t_mask[i])
             slice->source_images[i] = mark_value;
+    scene.slice_cache.clear();
     slice_need_update = true;
     glWidget->update();
 }
@@ -1514,14 +1514,14 @@ void TractTableWidget::reconnect_track(void)
     {
         bool ok;
         QString result = QInputDialog::getText(this,"DSI Studio","Assign maximum bridging distance (in voxels) and angles (degrees)",
-                                               QLineEdit::Normal,"4 30",&ok);
+                                               QLineEdit::Normal,"1 30",&ok);
 
         if(!ok)
             return;
         std::istringstream in(result.toStdString());
         float dis,angle;
         in >> dis >> angle;
-        if(dis <= 2.0f || angle <= 0.0f)
+        if(dis <= 0.0f || angle <= 0.0f)
             return;
         tract_models[currentRow()]->reconnect_track(dis,std::cos(angle*3.14159265358979323846f/180.0f));
     });